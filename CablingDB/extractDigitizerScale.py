@@ -6,12 +6,31 @@ import pprint
 import sys
 import requests
 import argparse
+import struct
+
+# Binary calibration table read by EventFormats/DigitizerCalibration.hpp, all little-endian:
+# magic "FDCT", uint32 version, uint32 number of entries, then for each entry in
+# increasing run order the uint32 first run and the float32 dynamic range in V of
+# each of the 16 channels. Channels without readout settings are written as NaN
+TABLE_MAGIC = b"FDCT"
+TABLE_VERSION = 1
+TABLE_CHANNELS = 16
+
+def write_table(range_map, filename):
+    with open(filename, "wb") as f:
+        f.write(TABLE_MAGIC)
+        f.write(struct.pack("<II", TABLE_VERSION, len(range_map)))
+        for runno in sorted(range_map):
+            ranges = [range_map[runno].get(chan, float("nan")) for chan in range(TABLE_CHANNELS)]
+            f.write(struct.pack(f"<I{TABLE_CHANNELS}f", runno, *ranges))
 
 # Parse any command-line options
 parser = argparse.ArgumentParser(description="Digitizer Scale Checker")
 
 parser.add_argument("-r", "--firstRun", default=0,
                     help="Specify first run to consider (default: all)")
+parser.add_argument("-o", "--output", default=None,
+                    help="Write the ranges as binary calibration table to this file")
 
 args = parser.parse_args()
 try:
@@ -103,5 +122,9 @@ pprint.pprint(range_map)
 #print(digitizer_map)
 print(f"Entries: {len(range_map)} runs")
 
+if args.output:
+    write_table(range_map, args.output)
+    print(f"Wrote calibration table {args.output}")
+
 #FIXME: should add check that last run always have full TI12 detector map future runs...
 
@@ -0,0 +1,69 @@
+/*
+  Copyright (C) 2019-2020 CERN for the benefit of the FASER collaboration
+*/
+
+///////////////////////////////////////////////////////////////////
+// BoundedQueue.hpp, (c) FASER Detector software
+///////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace DAQFormats {
+
+  /** \brief Blocking queue of limited size for passing work between threads
+   *
+   *  push() waits while the queue is full and pop() while it is empty. After
+   *  close() pushes are refused and pop() returns the remaining items before
+   *  reporting the end of the queue.
+   */
+  template <typename T> class BoundedQueue {
+  public:
+    explicit BoundedQueue(size_t capacity) : m_capacity(capacity ? capacity : 1), m_closed(false) {}
+
+    // prohibit copy and assign
+    BoundedQueue(const BoundedQueue& other) = delete;
+    BoundedQueue& operator=(const BoundedQueue& other) = delete;
+
+    /// Add item, returns false if the queue was closed
+    bool push(T item) {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_notFull.wait(lock, [this] { return m_closed || m_items.size()<m_capacity; });
+      if (m_closed) return false;
+      m_items.push_back(std::move(item));
+      m_notEmpty.notify_one();
+      return true;
+    }
+
+    /// Take oldest item, returns false if the queue is closed and empty
+    bool pop(T& item) {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_notEmpty.wait(lock, [this] { return m_closed || !m_items.empty(); });
+      if (m_items.empty()) return false;
+      item=std::move(m_items.front());
+      m_items.pop_front();
+      m_notFull.notify_one();
+      return true;
+    }
+
+    /// No more items will be added, wakes up all waiting threads
+    void close() {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_closed=true;
+      m_notFull.notify_all();
+      m_notEmpty.notify_all();
+    }
+
+  private:
+    const size_t m_capacity;
+    bool m_closed;
+    std::deque<T> m_items;
+    std::mutex m_mutex;
+    std::condition_variable m_notFull;
+    std::condition_variable m_notEmpty;
+  };
+
+}
@@ -0,0 +1,33 @@
+/*
+  Copyright (C) 2019-2020 CERN for the benefit of the FASER collaboration
+*/
+
+///////////////////////////////////////////////////////////////////
+// CpuFeatures.hpp, (c) FASER Detector software
+///////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define EVENTFORMATS_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/** \brief Vector instruction sets available at run time
+ *
+ *  Vectorized code paths beyond SSE2 (which every x86-64 CPU has) are compiled
+ *  with the target attribute instead of -march flags, so the same binary runs
+ *  everywhere and the best path is chosen with these checks. On other
+ *  architectures only the scalar code is used.
+ */
+struct CpuFeatures
+{
+  static bool avx2() {
+#ifdef EVENTFORMATS_X86_SIMD
+    static const bool has = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+    return has;
+#else
+    return false;
+#endif
+  }
+};
@@ -13,7 +13,15 @@
 #include <vector>
 #include <iomanip>
 #include <map>
+#include <array>
+#include <algorithm>
 #include <fstream>
+#include <memory>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <sys/uio.h>
+#include <unistd.h>
 #include "Exceptions/Exceptions.hpp"
 
 using namespace std::chrono_literals;
@@ -45,6 +53,11 @@ namespace DAQFormats {
   
   const uint16_t EventHeaderVersion = 0x0001;
 
+  const uint16_t FragmentVersionLatest = 0x0001;
+  const uint8_t FragmentMarker = 0xAA;
+  const uint16_t EventVersionLatest = 0x0001;
+  const uint8_t EventMarker = 0xBB;
+
   enum EventStatus { // to be reviewed as not all are relevant for FASER
     UnclassifiedError = 1,
     BCIDMismatch = 1<<1,
@@ -59,6 +72,99 @@ namespace DAQFormats {
     ErrorFragment = 1<<10    // used by event builder to wrap incoming non-deciphable data
   };
 
+  /// On-disk layout of the fragment header
+  struct EventFragmentHeader {
+    uint8_t marker;
+    uint8_t fragment_tag;
+    uint16_t trigger_bits;
+    uint16_t version_number;
+    uint16_t header_size;
+    uint32_t payload_size;
+    uint32_t source_id;
+    uint64_t event_id;
+    uint16_t bc_id;
+    uint16_t status;
+    uint64_t timestamp;
+  }  __attribute__((__packed__));
+
+  /// On-disk layout of the event header
+  struct EventHeader {
+    uint8_t marker;
+    uint8_t event_tag;
+    uint16_t trigger_bits;
+    uint16_t version_number;
+    uint16_t header_size;
+    uint32_t payload_size;
+    uint8_t  fragment_count;
+    unsigned int run_number : 24;
+    uint64_t event_id;
+    uint64_t event_counter;
+    uint16_t bc_id;
+    uint16_t status;
+    uint64_t timestamp;
+  }  __attribute__((__packed__));
+
+  /** \brief Check an encoded fragment header in place
+   *
+   *  Returns the header inside the given buffer, throws if the buffer does not
+   *  hold a complete fragment of a supported version
+   */
+  inline const EventFragmentHeader* checkFragmentHeader(const uint8_t *data, size_t size, bool allowExcessData=false) {
+    if (size<sizeof(EventFragmentHeader)) THROW(EFormatException,"Too little data for fragment header");
+    const EventFragmentHeader* header=reinterpret_cast<const EventFragmentHeader*>(data);
+    if (header->marker!=FragmentMarker) THROW(EFormatException,"No fragment header");
+    if (header->version_number!=FragmentVersionLatest) {
+      //FIXMEL should do conversion here
+      THROW(EFormatException,"Unsupported fragment version");
+    }
+    if (header->header_size<sizeof(EventFragmentHeader)) THROW(EFormatException,"Fragment header size too small");
+    if (size<header->header_size) THROW(EFormatException,"Too little data for fragment header");
+    if (size<header->header_size+header->payload_size) THROW(EFormatException,"Too little data for fragment");
+    if ((size!=header->header_size+header->payload_size)&&!allowExcessData) THROW(EFormatException,"fragment size does not match header information");
+    return header;
+  }
+
+  /** \brief Check an encoded event header in place
+   *
+   *  Only the event header itself is checked, not the fragments in the payload
+   */
+  inline const EventHeader* checkEventHeader(const uint8_t *data, size_t size) {
+    if (size<sizeof(EventHeader)) THROW(EFormatException,"Too small to be event");
+    const EventHeader* header=reinterpret_cast<const EventHeader*>(data);
+    if (header->marker!=EventMarker) THROW(EFormatException,"Wrong event header");
+    if (header->version_number!=EventVersionLatest) {
+      //should do conversion here
+      THROW(EFormatException,"Unsupported event format version");
+    }
+    if (header->header_size<sizeof(EventHeader)) THROW(EFormatException,"Event header size too small");
+    return header;
+  }
+
+  /** \brief Write all buffers described by iov to a file descriptor
+   *
+   *  Retries on partial writes and interrupts and splits requests longer than IOV_MAX.
+   *  The iovec array is modified while writing.
+   */
+  inline void writeAll(int fd, struct iovec *iov, size_t count) {
+    while (count) {
+      ssize_t written=::writev(fd, iov, static_cast<int>(std::min(count, static_cast<size_t>(IOV_MAX))));
+      if (written<0) {
+	if (errno==EINTR) continue;
+	THROW(EFormatException,std::string("Failed to write data: ")+strerror(errno));
+      }
+      size_t left=static_cast<size_t>(written);
+      while (count && left>=iov->iov_len) {
+	left-=iov->iov_len;
+	iov++;
+	count--;
+      }
+      if (count) {
+	iov->iov_base=static_cast<uint8_t*>(iov->iov_base)+left;
+	iov->iov_len-=left;
+      }
+    }
+  }
+
   /** \brief This class define DAQ fragment header encapsulating raw data
    *  from the experiment. Encoding/decoding and access functions are provided
    */
@@ -79,7 +185,7 @@ namespace DAQFormats {
       header.fragment_tag   = fragment_tag;
       header.trigger_bits   = 0;
       header.version_number = FragmentVersionLatest;
-      header.header_size    = sizeof(struct EventFragmentHeader);
+      header.header_size    = sizeof(EventFragmentHeader);
       header.payload_size   = payloadsize;
       header.source_id      = source_id;
       header.event_id       = event_id;
@@ -88,37 +194,35 @@ namespace DAQFormats {
       header.timestamp      = static_cast<uint64_t>(timestamp.count());
       fragment=byteVector(reinterpret_cast<const uint8_t *>(payload),
 			  reinterpret_cast<const uint8_t *>(payload)+payloadsize);
+      external=nullptr;
     }
   
     /** \brief Constructor given an already encoded fragment
      */
-    EventFragment(const uint8_t *data, size_t size, bool allowExcessData=false) {
-      if (size<8) THROW(EFormatException,"Too little data for fragment header");
-      const struct EventFragmentHeader* newHeader=reinterpret_cast<const struct EventFragmentHeader*>(data);
-      if (newHeader->marker!=FragmentMarker) THROW(EFormatException,"No fragment header");
-      if (newHeader->version_number!=FragmentVersionLatest) {
-	//FIXMEL should do conversion here
-	THROW(EFormatException,"Unsupported fragment version");
-      }
-      if (size<newHeader->header_size) THROW(EFormatException,"Too little data for fragment header");
-      if (size<newHeader->header_size+newHeader->payload_size) THROW(EFormatException,"Too little data for fragment");
-      if ((size!=newHeader->header_size+newHeader->payload_size)&&!allowExcessData) THROW(EFormatException,"fragment size does not match header information");
-      size=newHeader->header_size+newHeader->payload_size;
+    EventFragment(const uint8_t *data, size_t size, bool allowExcessData=false) : external(nullptr) {
+      const EventFragmentHeader* newHeader=checkFragmentHeader(data,size,allowExcessData);
       fragment=byteVector(data+newHeader->header_size,data+newHeader->header_size+newHeader->payload_size);
-      header=*(reinterpret_cast<const struct EventFragmentHeader *>(data));
+      header=*newHeader;
     }
 
+    /** \brief Constructor referencing the payload of an already checked fragment
+     *
+     *  The payload is not copied and has to outlive the fragment. Used by EventFull
+     *  to keep all fragments of an event in its own buffer
+     */
+    EventFragment(const EventFragmentHeader& fragmentHeader, const uint8_t *payload) :
+      header(fragmentHeader), external(payload) {}
+
     /// \brief Returns the payload as pointer of desired type
     template <typename T = void *> T payload() const {
       static_assert(std::is_pointer<T>(), "Type parameter must be a pointer type");
-      return reinterpret_cast<T>(fragment.data());
+      return reinterpret_cast<T>(payloadData());
     }
   
-    /// Return fragment as vector of bytes
+    /// Return fragment as vector of bytes. Caller owns the vector, prefer serialize_into()
     const byteVector * raw() const {
-      const uint8_t *rawHeader=reinterpret_cast<const uint8_t *>(&header);
-      byteVector* data=new byteVector(rawHeader,rawHeader+sizeof(header));
-      data->insert(data->end(),fragment.begin(),fragment.end());
+      byteVector* data=new byteVector(encoded_size());
+      serialize_into(data->data(), data->size());
       return data;
     }
 
@@ -126,8 +230,38 @@ namespace DAQFormats {
     void rawAppend(byteVector *data) const {
       const uint8_t *rawHeader=reinterpret_cast<const uint8_t *>(&header);
       data->insert(data->end(),rawHeader,rawHeader+sizeof(header));
-      data->insert(data->end(),fragment.begin(),fragment.end());
+      data->insert(data->end(),payloadData(),payloadData()+header.payload_size);
     }
+
+    /** \brief Call fn(data, size) for each contiguous piece of the encoded fragment
+     *
+     *  These are the header and the payload, which are not copied
+     */
+    template <typename Function> void forEachPiece(Function fn) const {
+      fn(reinterpret_cast<const uint8_t *>(&header), sizeof(header));
+      if (header.payload_size) fn(payloadData(), header.payload_size);
+    }
+
+    /// Append iovecs pointing to the encoded fragment, for use with writev
+    void gather(std::vector<struct iovec> &iov) const {
+      forEachPiece([&iov](const uint8_t *data, size_t size) {
+	iov.push_back({const_cast<uint8_t *>(data), size});
+      });
+    }
+
+    /// Encode fragment into preallocated buffer, returns number of bytes used
+    size_t serialize_into(uint8_t *buffer, size_t size) const {
+      if (size<encoded_size()) THROW(EFormatException,"Buffer too small for fragment");
+      uint8_t *pos=buffer;
+      forEachPiece([&pos](const uint8_t *data, size_t len) {
+	memcpy(pos, data, len);
+	pos+=len;
+      });
+      return static_cast<size_t>(pos-buffer);
+    }
+
+    /// Number of bytes written when encoding fragment
+    size_t encoded_size() const { return sizeof(header)+header.payload_size; }
   
     /// Set status bits
     void set_status(uint16_t status) {
@@ -157,22 +291,134 @@ namespace DAQFormats {
     uint64_t timestamp() const { return header.timestamp; }
     
   private:
-    const uint16_t FragmentVersionLatest = 0x0001;
-    const uint8_t FragmentMarker = 0xAA;
-    struct EventFragmentHeader {
-      uint8_t marker;
-      uint8_t fragment_tag;
-      uint16_t trigger_bits;
-      uint16_t version_number;
-      uint16_t header_size;
-      uint32_t payload_size;
-      uint32_t source_id;
-      uint64_t event_id;
-      uint16_t bc_id;
-      uint16_t status;
-      uint64_t timestamp;
-    }  __attribute__((__packed__)) header;
+    const uint8_t * payloadData() const { return external ? external : fragment.data(); }
+
+    EventFragmentHeader header;
     byteVector fragment;
+    const uint8_t * external; // payload owned by someone else, e.g. the event buffer
+  };
+
+  /** \brief Small table of fragments sorted by source id
+   *
+   *  Events rarely have more than a few tens of fragments, so entries are kept
+   *  in a sorted array stored inline in the table, only moving to the heap for
+   *  unusually large events. Source ids group by detector in the upper 16 bits,
+   *  so all fragments of one detector are a contiguous range of the table.
+   */
+  class FragmentTable {
+  public:
+    struct Entry {
+      uint32_t source_id;
+      const EventFragment* fragment;
+    };
+
+    /// Iterator over the fragments of the table, in order of source id
+    class const_iterator {
+    public:
+      using iterator_category = std::random_access_iterator_tag;
+      using value_type = EventFragment;
+      using difference_type = std::ptrdiff_t;
+      using pointer = const EventFragment*;
+      using reference = const EventFragment&;
+
+      explicit const_iterator(const Entry* entry=nullptr) : m_entry(entry) {}
+      reference operator*() const { return *m_entry->fragment; }
+      pointer operator->() const { return m_entry->fragment; }
+      const_iterator& operator++() { ++m_entry; return *this; }
+      const_iterator operator++(int) { const_iterator old(*this); ++m_entry; return old; }
+      difference_type operator-(const const_iterator& other) const { return m_entry-other.m_entry; }
+      bool operator==(const const_iterator& other) const { return m_entry==other.m_entry; }
+      bool operator!=(const const_iterator& other) const { return m_entry!=other.m_entry; }
+    private:
+      const Entry* m_entry;
+    };
+
+    /// Contiguous range of fragments, e.g. all fragments of one detector
+    class Range {
+    public:
+      Range(const Entry* first, const Entry* last) : m_first(first), m_last(last) {}
+      const_iterator begin() const { return const_iterator(m_first); }
+      const_iterator end() const { return const_iterator(m_last); }
+      size_t size() const { return static_cast<size_t>(m_last-m_first); }
+      bool empty() const { return m_first==m_last; }
+      const EventFragment& operator[](size_t ii) const { return *m_first[ii].fragment; }
+    private:
+      const Entry* m_first;
+      const Entry* m_last;
+    };
+
+    FragmentTable() : m_size(0), m_onHeap(false) {}
+
+    /// Add fragment, replacing any fragment with the same source id. Returns false if one was replaced
+    bool set(uint32_t source_id, const EventFragment* fragment) {
+      Entry* entries=data();
+      Entry* pos=entries+m_size;
+      if (m_size && entries[m_size-1].source_id>=source_id) { // not appending in order
+	pos=lowerBound(source_id);
+	if (pos!=entries+m_size && pos->source_id==source_id) {
+	  pos->fragment=fragment;
+	  return false;
+	}
+      }
+      size_t index=static_cast<size_t>(pos-entries);
+      if (!m_onHeap && m_size==InlineCapacity) {
+	m_heapEntries.assign(m_inlineEntries.begin(), m_inlineEntries.end());
+	m_onHeap=true;
+      }
+      if (m_onHeap) {
+	m_heapEntries.insert(m_heapEntries.begin()+static_cast<std::ptrdiff_t>(index), Entry{source_id, fragment});
+      } else {
+	std::copy_backward(m_inlineEntries.begin()+index, m_inlineEntries.begin()+m_size, m_inlineEntries.begin()+m_size+1);
+	m_inlineEntries[index]=Entry{source_id, fragment};
+      }
+      m_size++;
+      return true;
+    }
+
+    /// Find fragment with specific source id, nullptr if not present
+    const EventFragment* find(uint32_t source_id) const {
+      const Entry* pos=lowerBound(source_id);
+      if (pos==data()+m_size || pos->source_id!=source_id) return nullptr;
+      return pos->fragment;
+    }
+
+    /// All fragments from one detector, given by the upper 16 bits of source_id (e.g. TrackerSourceID)
+    Range range(uint32_t source_id) const {
+      uint32_t first=source_id&0xFFFF0000;
+      return Range(lowerBound(first), first==0xFFFF0000 ? data()+m_size : lowerBound(first+0x10000));
+    }
+
+    /// Remove all entries, keeping any heap storage
+    void clear() {
+      m_size=0;
+      m_heapEntries.clear();
+      m_onHeap=false;
+    }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size==0; }
+    const Entry& entry(size_t ii) const { return data()[ii]; }
+    const_iterator begin() const { return const_iterator(data()); }
+    const_iterator end() const { return const_iterator(data()+m_size); }
+
+  private:
+    static const size_t InlineCapacity = 32;
+
+    Entry* data() { return m_onHeap ? m_heapEntries.data() : m_inlineEntries.data(); }
+    const Entry* data() const { return m_onHeap ? m_heapEntries.data() : m_inlineEntries.data(); }
+    Entry* lowerBound(uint32_t source_id) {
+      return std::lower_bound(data(), data()+m_size, source_id,
+			      [](const Entry& entry, uint32_t id) { return entry.source_id<id; });
+    }
+    const Entry* lowerBound(uint32_t source_id) const {
+      return std::lower_bound(data(), data()+m_size, source_id,
+			      [](const Entry& entry, uint32_t id) { return entry.source_id<id; });
+    }
+
+    std::array<Entry, InlineCapacity> m_inlineEntries;
+    std::vector<Entry> m_heapEntries;
+    size_t m_size;
+    bool m_onHeap;
   };
 
     /** \brief This class define DAQ event header encapsulating one or more
@@ -194,7 +440,7 @@ namespace DAQFormats {
       header.event_tag      = event_tag;
       header.trigger_bits   = 0;
       header.version_number = EventVersionLatest;
-      header.header_size    = sizeof(struct EventHeader);
+      header.header_size    = sizeof(EventHeader);
       header.payload_size   = 0;
       header.fragment_count = 0;
       header.run_number     = run_number;
@@ -207,22 +453,38 @@ namespace DAQFormats {
 
     /// \brief Constructor given an existing event in stream of bytes 
     EventFull(const uint8_t *data,size_t eventsize) {
+      load(data, eventsize);
+    }
 
-      // Read EventHeader out of byte stream
-      loadHeader(data, eventsize);
-
-      // Skip forward by amount of data actually read
-      uint32_t dataLeft = eventsize - header.header_size;
-      data+=header.header_size;
-
-      // Read payload objects from remaining data
-      loadPayload(data, dataLeft);
+    /// \brief Constructor reading an existing event from a file stream
+    EventFull(std::ifstream &in) {
+      read(in);
+    }
 
+    /** \brief Replace content with an existing event in stream of bytes
+     *
+     *  The event is copied into a single buffer owned by the event, which also
+     *  holds the payloads of all fragments. The buffer is kept when loading the
+     *  next event, so reusing one EventFull avoids allocations per event.
+     */
+    void load(const uint8_t *data,size_t eventsize) {
+      clear();
+      const EventHeader* newHeader=checkEventHeader(data, eventsize);
+      if (eventsize<newHeader->header_size || eventsize-newHeader->header_size!=newHeader->payload_size) {
+	THROW(EFormatException, "Payload size does not match header information");
+      }
+      arena.assign(data, data+eventsize);
+      header=*newHeader;
+      loadArenaFragments(arena.data()+header.header_size);
     }
 
-    /// \brief Constructor reading an existing event from a file stream
+    /** \brief Replace content with the next event from a file stream
+     *
+     *  Reads directly into the event buffer, see load()
+     */
     // FIXME: no format migration support or for partially corrupted events
-    EventFull(std::ifstream &in) {
+    void read(std::ifstream &in) {
+      clear();
       in.read(reinterpret_cast<char *>(&header),sizeof(header));
       if (in.fail()) THROW(EFormatException,"Too small to be event");
       if (header.marker!=EventMarker) THROW(EFormatException,"Wrong event header");
@@ -231,54 +493,100 @@ namespace DAQFormats {
 	THROW(EFormatException,"Unsupported event format version");
       }
       if (header.payload_size>1000000) THROW(EFormatException,"Payload size too large (>1000000)");
-      uint8_t* data=new uint8_t[header.payload_size];
-      uint8_t* full=data;
-      in.read(reinterpret_cast<char *>(data),header.payload_size);
+      arena.resize(sizeof(header)+header.payload_size);
+      std::copy(reinterpret_cast<const uint8_t *>(&header),reinterpret_cast<const uint8_t *>(&header)+sizeof(header),arena.begin());
+      in.read(reinterpret_cast<char *>(arena.data()+sizeof(header)),header.payload_size);
       if (in.fail()) THROW(EFormatException,"Event size does not match header information");
-
-      uint32_t dataLeft=header.payload_size;
-
-      for(int fragNum=0;fragNum<header.fragment_count;fragNum++) {
-	EventFragment *fragment=new EventFragment(data,dataLeft,true);
-	data+=fragment->size();
-	dataLeft-=fragment->size();
-	fragments[fragment->source_id()]=fragment;
-      }
-      delete [] full;
+      loadArenaFragments(arena.data()+sizeof(header));
     }
 
-
+    /// Remove all fragments, keeping allocated buffers for reuse
+    void clear() {
+      fragments.clear();
+      arenaFragments.clear();
+      ownedFragments.clear();
+      header.fragment_count = 0;
+      header.payload_size   = 0;
+    }
 
     /// OR's new error flags into existing ones
     void updateStatus(uint16_t status) {
       header.status|=status;
     }
 
-    /// Return full event as vector of bytes
+    /// Set event tag, e.g. when marking an event as incomplete
+    void set_event_tag(uint8_t event_tag) {
+      header.event_tag=event_tag;
+    }
+
+    /// Return full event as vector of bytes. Caller owns the vector, prefer serialize_into() or write_to()
     byteVector* raw() {
-      const uint8_t *rawHeader=reinterpret_cast<const uint8_t *>(&header);
-      byteVector* full=new byteVector(rawHeader,rawHeader+sizeof(header));
-      for(const auto& frag: fragments) {
-	frag.second->rawAppend(full);
-      }
+      byteVector* full=new byteVector(encoded_size());
+      serialize_into(full->data(), full->size());
       return full;
     }
 
-    ~EventFull() {
-      for(const auto& frag: fragments) { // FIXME: should use smarter pointers for memory management
-	delete frag.second;
+    /** \brief Call fn(data, size) for each contiguous piece of the encoded event
+     *
+     *  These are the event header followed by header and payload of each fragment
+     */
+    template <typename Function> void forEachPiece(Function fn) const {
+      fn(reinterpret_cast<const uint8_t *>(&header), sizeof(header));
+      for(const auto& frag: fragments) {
+	frag.forEachPiece(fn);
       }
     }
+
+    /// Append iovecs pointing to the encoded event, for use with writev
+    void gather(std::vector<struct iovec> &iov) const {
+      forEachPiece([&iov](const uint8_t *data, size_t size) {
+	iov.push_back({const_cast<uint8_t *>(data), size});
+      });
+    }
+
+    /// Encode event into preallocated buffer, returns number of bytes used
+    size_t serialize_into(uint8_t *buffer, size_t size) const {
+      if (size<encoded_size()) THROW(EFormatException,"Buffer too small for event");
+      uint8_t *pos=buffer;
+      forEachPiece([&pos](const uint8_t *data, size_t len) {
+	memcpy(pos, data, len);
+	pos+=len;
+      });
+      return static_cast<size_t>(pos-buffer);
+    }
+
+    /// Write encoded event to a file descriptor with a single writev, without copying
+    void write_to(int fd) const {
+      struct iovec iov[MaxPieces];
+      size_t count=0;
+      forEachPiece([&iov, &count](const uint8_t *data, size_t size) {
+	if (count==MaxPieces) THROW(EFormatException,"Too many fragments to write event");
+	iov[count++]={const_cast<uint8_t *>(data), size};
+      });
+      writeAll(fd, iov, count);
+    }
+
+    /// Number of bytes written when encoding event
+    size_t encoded_size() const {
+      size_t total=sizeof(header);
+      for(const auto& frag: fragments) total+=frag.encoded_size();
+      return total;
+    }
+
     /** \brief Appends fragment to list of fragments in event
      *
-     *  Ownership is taken of fragment, i.e. don't delete it later
+     *  Ownership is taken of fragment, i.e. don't delete it later.
+     *  At most MaxFragments can be added, as the count is encoded in 8 bits.
      */
 
-    int16_t addFragment(const EventFragment* fragment) { // FIXME: should use smarter pointers for memory management
+    int16_t addFragment(const EventFragment* fragment) {
       int16_t status=0;
-      if (fragments.find(fragment->source_id())!=fragments.end()) 
+      if (fragments.find(fragment->source_id())) 
 	THROW(EFormatException,"Duplicate fragment addition!");
-      fragments[fragment->source_id()]=fragment;
+      if (header.fragment_count==MaxFragments)
+	THROW(EFormatException,"Too many fragments in event");
+      ownedFragments.emplace_back(fragment);
+      fragments.set(fragment->source_id(),fragment);
       if (!header.fragment_count) {
 	header.bc_id=fragment->bc_id();
 	header.event_id = fragment->event_id();
@@ -294,37 +602,33 @@ namespace DAQFormats {
 
       //BP: could check for event ID mismatch, but should not happen...
 
-      updateStatus(fragment->status()|status);
+      updateStatus(static_cast<uint16_t>(fragment->status()|status));
       return status;
     }
 
     // \brief Load header from stream of bytes
     // Return actual size of header
     uint16_t loadHeader(const uint8_t *data, size_t datasize) {
-      if (datasize<sizeof(struct EventHeader)) THROW(EFormatException,"Too small to be event");
-      header=*reinterpret_cast<const struct EventHeader *>(data);
-      if (header.marker!=EventMarker) THROW(EFormatException,"Wrong event header");
-      if (header.version_number!=EventVersionLatest) {
-	//should do conversion here
-	THROW(EFormatException,"Unsupported event format version");
-      }
+      header=*checkEventHeader(data, datasize);
 
       return header_size(); 
     }
 
     // \brief Load payload from stream of bytes
+    // The payload is copied into the event buffer after the header, as in read()
     void loadPayload(const uint8_t *data, size_t datasize) {
 
       if (datasize != header.payload_size) {
 	THROW(EFormatException, "Payload size does not match header information");
       }
 
-      for(int fragNum=0;fragNum<header.fragment_count;fragNum++) {
-	EventFragment *fragment=new EventFragment(data,datasize,true);
-	data+=fragment->size();
-	datasize-=fragment->size();
-	fragments[fragment->source_id()]=fragment;
-      }
+      EventHeader loadedHeader=header;
+      clear();
+      header=loadedHeader;
+      arena.resize(sizeof(header)+datasize);
+      std::copy(reinterpret_cast<const uint8_t *>(&header),reinterpret_cast<const uint8_t *>(&header)+sizeof(header),arena.begin());
+      std::copy(data,data+datasize,arena.begin()+sizeof(header));
+      loadArenaFragments(arena.data()+sizeof(header));
     }
 
     // getters here
@@ -341,55 +645,82 @@ namespace DAQFormats {
     uint16_t trigger_bits() const { return header.trigger_bits; }
     uint16_t fragment_count() const { return header.fragment_count; }
 
-    /// Get list of fragment source ids
+    /// Event header as it will be encoded
+    const EventHeader& event_header() const { return header; }
+
+    /// Get list of fragment source ids. Allocates, prefer iterating over the event instead
     std::vector<uint32_t> getFragmentIDs() const {
       std::vector<uint32_t> ids;
-      for(const auto & frag : fragments) {
-	ids.push_back(frag.first);
+      ids.reserve(fragments.size());
+      for(size_t ii=0;ii<fragments.size();ii++) {
+	ids.push_back(fragments.entry(ii).source_id);
       }
       return ids;
     }
     
     /// Find fragment with specific source id
     const EventFragment* find_fragment(uint32_t source_id) const {
-      if (fragments.find(source_id)==fragments.end()) return nullptr;
-      return fragments.find(source_id)->second;
+      return fragments.find(source_id);
     }
 
+    /** \brief All fragments of one detector, in order of source id
+     *
+     *  For example fragments_of(TrackerSourceID) gives all tracker fragments
+     */
+    FragmentTable::Range fragments_of(uint32_t source_id) const {
+      return fragments.range(source_id);
+    }
+
+    /// Iterate over all fragments in order of source id
+    FragmentTable::const_iterator begin() const { return fragments.begin(); }
+    FragmentTable::const_iterator end() const { return fragments.end(); }
+
+    /// Largest number of fragments in one event
+    static const uint8_t MaxFragments = 255;
+
   private:
-    const uint16_t EventVersionLatest = 0x0001;
-    const uint8_t EventMarker = 0xBB;
-    struct EventHeader {
-      uint8_t marker;
-      uint8_t event_tag;
-      uint16_t trigger_bits;
-      uint16_t version_number;
-      uint16_t header_size;
-      uint32_t payload_size;
-      uint8_t  fragment_count;
-      unsigned int run_number : 24;
-      uint64_t event_id;  
-      uint64_t event_counter;
-      uint16_t bc_id;
-      uint16_t status;
-      uint64_t timestamp;
-    }  __attribute__((__packed__)) header;
-    std::map<uint32_t,const EventFragment*> fragments;
+    /// Event header plus header and payload of each fragment
+    static const size_t MaxPieces = 1+2*MaxFragments;
+
+    /// Create fragments referencing the payloads in the event buffer
+    void loadArenaFragments(const uint8_t* data) {
+      size_t dataLeft=header.payload_size;
+      arenaFragments.reserve(header.fragment_count); // no reallocation, fragments are referenced by pointer
+      for(int fragNum=0;fragNum<header.fragment_count;fragNum++) {
+	const EventFragmentHeader* fragHeader=checkFragmentHeader(data,dataLeft,true);
+	arenaFragments.emplace_back(*fragHeader, data+fragHeader->header_size);
+	const EventFragment* fragment=&arenaFragments.back();
+	data+=fragment->size();
+	dataLeft-=fragment->size();
+	fragments.set(fragment->source_id(),fragment);
+      }
+    }
+
+    EventHeader header;
+    FragmentTable fragments;
+    byteVector arena;                          // encoded event when loaded from bytes or stream
+    std::vector<EventFragment> arenaFragments; // fragments with payload in arena
+    std::vector<std::unique_ptr<const EventFragment>> ownedFragments; // fragments added or copied individually
   };
 
 }
 
-inline std::ostream &operator<<(std::ostream &out, const  DAQFormats::EventFragment &frag) {
-  out<<" Fragment: tag="<<static_cast<int>(frag.fragment_tag())
-     <<" source=0x"<<std::hex<<std::setfill('0')<<std::setw(4)<<std::hex<<frag.source_id()
-     <<" bc="<<std::dec<<std::setfill(' ')<<std::setw(4)<<frag.bc_id()
-     <<" status=0x"<<std::hex<<std::setw(4)<<std::setfill('0')<<frag.status()
-     <<" payload="<<std::dec<<std::setfill(' ')<<std::setw(5)<<frag.payload_size()
-     <<" bytes";
+namespace DAQFormats {
+  /// Print fragment header information, shared by EventFragment and FragmentView
+  template <typename FragmentType>
+  inline std::ostream &printFragmentHeader(std::ostream &out, const FragmentType &frag) {
+    out<<" Fragment: tag="<<static_cast<int>(frag.fragment_tag())
+       <<" source=0x"<<std::hex<<std::setfill('0')<<std::setw(4)<<std::hex<<frag.source_id()
+       <<" bc="<<std::dec<<std::setfill(' ')<<std::setw(4)<<frag.bc_id()
+       <<" status=0x"<<std::hex<<std::setw(4)<<std::setfill('0')<<frag.status()
+       <<" payload="<<std::dec<<std::setfill(' ')<<std::setw(5)<<frag.payload_size()
+       <<" bytes";
     return out;
-}
+  }
 
-inline std::ostream &operator<<(std::ostream &out, const  DAQFormats::EventFull &ev) {
+  /// Print event header information, shared by EventFull and EventView
+  template <typename EventType>
+  inline std::ostream &printEventHeader(std::ostream &out, const EventType &ev) {
     out<<"Event: "<<std::setw(8)<<ev.event_counter()<<" (0x"<<std::hex<<std::setfill('0') <<std::setw(8)<<ev.event_id()<<") "
        <<std::setfill(' ')
        <<" run="<<std::dec<<ev.run_number()
@@ -403,6 +734,15 @@ inline std::ostream &operator<<(std::ostream &out, const  DAQFormats::EventFull
        <<" payload="<<std::dec<<std::setw(6)<<ev.payload_size()
        <<" bytes";
     return out;
+  }
+}
+
+inline std::ostream &operator<<(std::ostream &out, const  DAQFormats::EventFragment &frag) {
+  return DAQFormats::printFragmentHeader(out, frag);
+}
+
+inline std::ostream &operator<<(std::ostream &out, const  DAQFormats::EventFull &ev) {
+  return DAQFormats::printEventHeader(out, ev);
 }
 
 #define customdatatypeList (DataFragment<EventFull>)(DataFragment<EventFragment>)
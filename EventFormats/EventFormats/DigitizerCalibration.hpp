@@ -0,0 +1,191 @@
+/*
+  Copyright (C) 2019-2020 CERN for the benefit of the FASER collaboration
+*/
+
+///////////////////////////////////////////////////////////////////
+// DigitizerCalibration.hpp, (c) FASER Detector software
+///////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "Exceptions/Exceptions.hpp"
+#include "EventFormats/CpuFeatures.hpp"
+#include "EventFormats/DigitizerDataFragment.hpp"
+
+CREATE_EXCEPTION_TYPE(CalibrationException,DigitizerData)
+
+/** \brief Conversion of digitizer ADC counts to mV
+ *
+ *  The dynamic range of each channel (2 V or 0.5 V) is stored in CablingDB and
+ *  changes with the run. CablingDB/extractDigitizerScale.py -o writes it as a
+ *  small binary table, all little-endian: the magic "FDCT", a uint32 version,
+ *  a uint32 number of entries, then for each entry in increasing run order the
+ *  uint32 first run and the float32 range in V of each of the 16 channels,
+ *  NaN for channels without readout settings. An entry holds from its first
+ *  run up to the next entry.
+ *
+ *  calibrate() subtracts a pedestal, for example WaveformFeatures::baseline_mean,
+ *  and scales by range/16384 of the 14-bit ADC. Samples are converted eight at
+ *  a time with AVX2 on x86-64 CPUs that have it and with plain C++ elsewhere,
+ *  both giving identical results.
+ */
+class DigitizerCalibration {
+public:
+  static const uint32_t VERSION = 1;
+  static constexpr float ADC_COUNTS = 16384.f;
+
+  struct Entry {
+    uint32_t first_run;
+    std::array<float, N_MAX_CHAN> range; ///< dynamic range in V of each channel
+  };
+
+  DigitizerCalibration() {}
+  explicit DigitizerCalibration(const std::string& filename) { read(filename); }
+
+  void read(const std::string& filename) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) THROW(DigitizerData::CalibrationException, "Cannot open calibration table " + filename);
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    read(data.data(), data.size());
+  }
+
+  /// Replace the table with the one in data, as written by extractDigitizerScale.py
+  void read(const uint8_t* data, size_t size) {
+    const size_t HEADER_SIZE = 12;
+    const size_t ENTRY_SIZE = 4 * (1 + N_MAX_CHAN);
+    if (size < HEADER_SIZE || std::memcmp(data, "FDCT", 4))
+      THROW(DigitizerData::CalibrationException, "Not a digitizer calibration table");
+    uint32_t version = readWord(data + 4);
+    if (version != VERSION)
+      THROW(DigitizerData::CalibrationException, "Unsupported calibration table version " + std::to_string(version));
+    uint32_t count = readWord(data + 8);
+    if (size != HEADER_SIZE + ENTRY_SIZE * count)
+      THROW(DigitizerData::CalibrationException, "Calibration table size (" + std::to_string(size) + ") does not match its " + std::to_string(count) + " entries");
+
+    std::vector<Entry> entries(count);
+    const uint8_t* pos = data + HEADER_SIZE;
+    for (Entry& entry : entries) {
+      entry.first_run = readWord(pos);
+      for (size_t channel = 0; channel < N_MAX_CHAN; channel++) {
+        uint32_t word = readWord(pos + 4 * (channel + 1));
+        std::memcpy(&entry.range[channel], &word, sizeof(word));
+      }
+      pos += ENTRY_SIZE;
+    }
+    for (size_t i = 1; i < entries.size(); i++)
+      if (entries[i].first_run <= entries[i-1].first_run)
+        THROW(DigitizerData::CalibrationException, "Calibration table runs are not in increasing order");
+    m_entries.swap(entries);
+  }
+
+  /// Add or replace the entry starting at firstRun
+  void add(uint32_t firstRun, const std::array<float, N_MAX_CHAN>& range) {
+    auto it = std::lower_bound(m_entries.begin(), m_entries.end(), firstRun,
+                               [](const Entry& entry, uint32_t run) { return entry.first_run < run; });
+    if (it != m_entries.end() && it->first_run == firstRun) it->range = range;
+    else m_entries.insert(it, Entry{firstRun, range});
+  }
+
+  const std::vector<Entry>& entries() const { return m_entries; }
+
+  /// Entry holding for run, throws if the table starts after it
+  const Entry& entry(uint32_t run) const {
+    auto it = std::upper_bound(m_entries.begin(), m_entries.end(), run,
+                               [](uint32_t r, const Entry& entry) { return r < entry.first_run; });
+    if (it == m_entries.begin())
+      THROW(DigitizerData::CalibrationException, "No digitizer calibration for run " + std::to_string(run));
+    return *(it - 1);
+  }
+
+  /// Dynamic range in V, throws if the channel has no valid range in this run
+  float range(uint32_t run, int channel) const {
+    checkChannel(channel);
+    float value=entry(run).range[static_cast<size_t>(channel)];
+    if (!(value>0))
+      THROW(DigitizerData::CalibrationException, "No dynamic range for digitizer channel " + std::to_string(channel) + " in run " + std::to_string(run));
+    return value;
+  }
+
+  /// mV per ADC count
+  float scale(uint32_t run, int channel) const {
+    return range(run, channel) * 1000.f / ADC_COUNTS;
+  }
+
+  /// out[i] = (samples[i] - pedestal) * scale(run, channel) in mV, out must hold samples.size() values
+  void calibrate(uint32_t run, int channel, const DigitizerData::ChannelView& samples, float pedestal, float* out) const {
+    convert(samples.data(), samples.size(), pedestal, scale(run, channel), out);
+  }
+
+  /// Same rounded to the nearest µV, ties to even
+  void calibrate(uint32_t run, int channel, const DigitizerData::ChannelView& samples, float pedestal, int32_t* out) const {
+    convert(samples.data(), samples.size(), pedestal, 1000.f * scale(run, channel), out);
+  }
+
+  template <typename T>
+  static void convert(const uint16_t* samples, size_t n, float pedestal, float scale, T* out) {
+    size_t i = 0;
+#ifdef EVENTFORMATS_X86_SIMD
+    if (CpuFeatures::avx2()) i = convertAVX2(samples, n, pedestal, scale, out);
+#endif
+    for (; i < n; i++) store(out + i, (static_cast<float>(samples[i]) - pedestal) * scale);
+  }
+
+private:
+  static uint32_t readWord(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+           static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+  }
+
+  static void checkChannel(int channel) {
+    if (channel < 0 || channel >= N_MAX_CHAN)
+      THROW(DigitizerData::CalibrationException, "Invalid digitizer channel " + std::to_string(channel));
+  }
+
+  static void store(float* out, float value) { *out = value; }
+  static void store(int32_t* out, float value) {
+    // same rounding and out of range value as _mm256_cvtps_epi32
+    float rounded = std::nearbyint(value);
+    *out = (rounded >= -2147483648.f && rounded < 2147483648.f) ? static_cast<int32_t>(rounded) : INT32_MIN;
+  }
+
+#ifdef EVENTFORMATS_X86_SIMD
+  __attribute__((target("avx2")))
+  static __m256 convertBlock(const uint16_t* samples, __m256 pedestal, __m256 scale) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples));
+    return _mm256_mul_ps(_mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(x)), pedestal), scale);
+  }
+
+  /// Blocks of 8 samples, returns the number converted
+  __attribute__((target("avx2")))
+  static size_t convertAVX2(const uint16_t* samples, size_t n, float pedestal, float scale, float* out) {
+    const __m256 pedestalVec = _mm256_set1_ps(pedestal);
+    const __m256 scaleVec = _mm256_set1_ps(scale);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+      _mm256_storeu_ps(out + i, convertBlock(samples + i, pedestalVec, scaleVec));
+    return i;
+  }
+
+  __attribute__((target("avx2")))
+  static size_t convertAVX2(const uint16_t* samples, size_t n, float pedestal, float scale, int32_t* out) {
+    const __m256 pedestalVec = _mm256_set1_ps(pedestal);
+    const __m256 scaleVec = _mm256_set1_ps(scale);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i),
+                          _mm256_cvtps_epi32(convertBlock(samples + i, pedestalVec, scaleVec)));
+    return i;
+  }
+#endif
+
+  std::vector<Entry> m_entries;
+};
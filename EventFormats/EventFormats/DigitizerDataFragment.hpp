@@ -7,9 +7,14 @@
 ///////////////////////////////////////////////////////////////////
 
 #pragma once
+#include <array>
 #include <map>
 #include <bitset>
 #include <cstring> //memcpy
+#include <iomanip>
+#include <new>
+#include <stdexcept>
+#include <vector>
 #include "Exceptions/Exceptions.hpp"
 //#include "Logging.hpp"
 
@@ -27,92 +32,225 @@ static inline unsigned int GetBit(unsigned int word, int bit_location){
 }
 CREATE_EXCEPTION_TYPE(DigitizerDataException,DigitizerData)
 
-struct DigitizerDataFragment { 
+namespace DigitizerData {
+  /// Allocator for memory starting at a multiple of Alignment bytes, so that SIMD code can use aligned loads
+  template <typename T, size_t Alignment> struct AlignedAllocator {
+    typedef T value_type;
+    template <typename U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+    AlignedAllocator() noexcept {}
+    template <typename U> AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+    T* allocate(size_t n) { return static_cast<T*>(::operator new(n*sizeof(T), std::align_val_t(Alignment))); }
+    void deallocate(T* p, size_t) noexcept { ::operator delete(p, std::align_val_t(Alignment)); }
+
+    template <typename U> bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept { return true; }
+    template <typename U> bool operator!=(const AlignedAllocator<U, Alignment>&) const noexcept { return false; }
+  };
 
 ////////////////////////////////////////////////////
-/// Constructor for creating a parsed digitizer event fragment
-////////////////////////////////////////////////////  
-  DigitizerDataFragment( const uint32_t *data, size_t size ) {
-    m_size = size;
-    
-    // is there at least a header
-    if( size < 16 ){
-      //      ERROR("Cannot find a header with at least 4 32 bit words");
-      //      ERROR("Data size : "<<size);
-      THROW(DigitizerData::DigitizerDataException, "The fragment is not big enough to even be a header");
-    }
-    
-    // decode header
-    event.event_size            = data[0] & 0x0FFFFFFF;
-    event.board_id              = data[1] >> 27;
-    event.board_fail_flag       = GetBit(data[1], 26);
-    event.pattern_trig_options  = (data[1] & 0x00FFFFFF) >> 8;
-    event.channel_mask          = (data[1] & 0x000000FF) | ((data[2] & 0xFF000000) >> 16);
-    event.event_counter         = data[2] & 0x00FFFFFF;
-    event.trigger_time_tag      = data[3];
-
-    // check the consistency of the apparent size of the event and the size recorded in the payload
-    // note that you need to multiply by 4 because the size is given in bytes of 8 bits but the event size is encoded
-    // as the number of 32 bit words
-    if( (event.event_size*4) != size ){
-          //  ERROR("Expected and observed size of payload do not agree");
-          //  ERROR("Expected = "<<size<<"  vs.  Observed = "<<event.event_size*4);
-      THROW(DigitizerData::DigitizerDataException, "Mismatch in payload size (" + std::to_string(size) + ") and expected size (" + std::to_string(event.event_size*4) + ")");
-    }
-    
-    // parse the ADC count data
-    // subtract 4 for the header to get the size of the data payload
-    unsigned int event_size_no_header = event.event_size-4;
+/// Read-only view of the ADC counts of one channel, to be used like a const std::vector<uint16_t>.
+/// It points into the fragment or view and is only valid as long as that is not changed or deleted.
+////////////////////////////////////////////////////
+  class ChannelView {
+  public:
+    typedef uint16_t value_type;
+    typedef const uint16_t* const_iterator;
+    typedef const uint16_t* iterator;
 
-    // count the number of active channels
-    unsigned int n_channels_active=0;
-    for(int iChan=0; iChan<N_MAX_CHAN; iChan++){
-      if( GetBit(event.channel_mask,iChan)==1 )
-        n_channels_active++;
-    }
+    ChannelView() : m_data(nullptr), m_size(0) {}
+    ChannelView(const uint16_t* data, size_t size) : m_data(data), m_size(size) {}
 
-    // divide modified event size by number of channels
-    if(event_size_no_header%n_channels_active != 0){
-      //      ERROR("The amount of data and the number of channels are not divisible");
-      //      ERROR("DataLength = "<<event_size_no_header<<"  /  NChannels = "<<n_channels_active);
-      THROW(DigitizerData::DigitizerDataException, "Mismatch in data length and number of enabled channels");
+    const uint16_t* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size==0; }
+    const_iterator begin() const { return m_data; }
+    const_iterator end() const { return m_data+m_size; }
+    uint16_t operator[](size_t index) const { return m_data[index]; }
+    uint16_t at(size_t index) const {
+      if (index>=m_size) throw std::out_of_range("DigitizerData::ChannelView::at");
+      return m_data[index];
     }
-    unsigned int words_per_channel = event_size_no_header/n_channels_active;
+    /// Copy of the samples, for code that needs to own them
+    operator std::vector<uint16_t>() const { return std::vector<uint16_t>(begin(), end()); }
 
-    // there are two readings per word
-    unsigned int samples_per_channel = 2*words_per_channel;
-    event.n_samples = samples_per_channel;
+  private:
+    const uint16_t* m_data;
+    size_t m_size;
+  };
+}
 
-    // location of pointer to start at begin of channel
-    // starts at 4 because that is size of header
-    unsigned int current_start_location = 4;
-    
-    for(int iChan=0; iChan<N_MAX_CHAN; iChan++){
-        
-      // make an empty vector entry for the data for every channel, regardless of whether it was enabled
-      event.adc_counts[iChan] = {};
-      
-      // only fill it if it is enabled
-      if( GetBit(event.channel_mask,iChan)==0 )
-        continue;
-      
-      for(unsigned int iDat=current_start_location; iDat<current_start_location+words_per_channel; iDat++){
-        // two readings are stored in one word
-        unsigned int chData = data[iDat];
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define DIGITIZER_ZERO_COPY
+#endif
+
+////////////////////////////////////////////////////
+/// Digitizer fragment read in place. The header is checked and decoded, and
+/// the samples of each enabled channel are taken directly from the payload,
+/// where each word holds sample n in the low and sample n+1 in the high half.
+/// On little-endian hosts that is already a uint16_t array in time order, so
+/// nothing is copied. On other hosts the samples are unpacked into a buffer
+/// of the view. The payload has to stay valid while the view is used.
+////////////////////////////////////////////////////
+class DigitizerView {
+  public:
+    DigitizerView() : m_data(nullptr), m_size(0), m_event_size(0), m_board_id(0), m_board_fail_flag(false),
+		      m_pattern_trig_options(0), m_channel_mask(0), m_event_counter(0), m_trigger_time_tag(0),
+		      m_n_samples(0), m_offsets{} {}
+    DigitizerView( const uint32_t *data, size_t size ) : DigitizerView() { set(data, size); }
 
-        // the data is actually arranged in a perhaps nonintuitive way
-        // the top half of the word is actually the second made in this doublet
-        // while the bottom half of the word is the first measurement
-        unsigned int adccount_second_measurement    = (chData & 0xFFFF0000) >> 16;  // sample[n+1]
-        unsigned int adccount_first_measurement     = (chData & 0x0000FFFF);        // sample[n]
+    /// Point the view to new data, throws DigitizerDataException if the header does not match the size
+    void set( const uint32_t *data, size_t size );
 
-        event.adc_counts[iChan].push_back(adccount_first_measurement );
-        event.adc_counts[iChan].push_back(adccount_second_measurement );
+    uint32_t event_size() const { return m_event_size; }
+    uint32_t board_id() const { return m_board_id; }
+    uint32_t board_fail_flag() const { return m_board_fail_flag; }
+    uint32_t pattern_trig_options() const { return m_pattern_trig_options; }
+    uint32_t channel_mask() const { return m_channel_mask; }
+    uint32_t event_counter() const { return m_event_counter; }
+    uint32_t trigger_time_tag() const { return m_trigger_time_tag; }
+    unsigned int n_samples() const { return m_n_samples; }
+    bool channel_has_data(int channel) const { return GetBit(m_channel_mask, channel); }
+    size_t size() const { return m_size; }
 
+    /// Samples of one channel, empty if the channel was not read out
+    DigitizerData::ChannelView channel_adc_counts(int channel) const {
+      if( channel<0 || channel>=N_MAX_CHAN ){
+        THROW(DigitizerData::DigitizerDataException, "The requested channel is not in the adc counts map.");
       }
+      if( !channel_has_data(channel) ) return DigitizerData::ChannelView();
+#ifdef DIGITIZER_ZERO_COPY
+      const uint16_t* samples = reinterpret_cast<const uint16_t*>(m_data);
+#else
+      const uint16_t* samples = m_unpacked.data();
+#endif
+      return DigitizerData::ChannelView(samples + m_offsets[static_cast<size_t>(channel)], m_n_samples);
+    }
+
+  private:
+    const uint32_t* m_data;
+    size_t m_size;
+    uint32_t m_event_size;
+    uint32_t m_board_id;
+    bool     m_board_fail_flag;
+    uint16_t m_pattern_trig_options;
+    uint16_t m_channel_mask;
+    uint32_t m_event_counter;
+    uint32_t m_trigger_time_tag;
+    unsigned int m_n_samples;
+    std::array<size_t, N_MAX_CHAN> m_offsets; // first sample of each channel, in the payload or in m_unpacked
+#ifndef DIGITIZER_ZERO_COPY
+    std::vector<uint16_t> m_unpacked;
+#endif
+};
+
+inline void DigitizerView::set( const uint32_t *data, size_t size ) {
+  m_data = data;
+  m_size = size;
+
+  // is there at least a header
+  if( size < 16 ){
+    THROW(DigitizerData::DigitizerDataException, "The fragment is not big enough to even be a header");
+  }
+
+  // decode header
+  m_event_size            = data[0] & 0x0FFFFFFF;
+  m_board_id              = data[1] >> 27;
+  m_board_fail_flag       = GetBit(data[1], 26);
+  m_pattern_trig_options  = static_cast<uint16_t>((data[1] & 0x00FFFFFF) >> 8);
+  m_channel_mask          = static_cast<uint16_t>((data[1] & 0x000000FF) | ((data[2] & 0xFF000000) >> 16));
+  m_event_counter         = data[2] & 0x00FFFFFF;
+  m_trigger_time_tag      = data[3];
+
+  // check the consistency of the apparent size of the event and the size recorded in the payload
+  // note that you need to multiply by 4 because the size is given in bytes of 8 bits but the event size is encoded
+  // as the number of 32 bit words
+  if( (m_event_size*4) != size ){
+    THROW(DigitizerData::DigitizerDataException, "Mismatch in payload size (" + std::to_string(size) + ") and expected size (" + std::to_string(m_event_size*4) + ")");
+  }
 
-      // move the starting location to the start of the next channels data
-      current_start_location += words_per_channel;
+  // subtract 4 for the header to get the size of the data payload
+  unsigned int event_size_no_header = m_event_size-4;
+
+  // count the number of active channels
+  unsigned int n_channels_active = static_cast<unsigned int>(__builtin_popcount(m_channel_mask));
+
+  // divide modified event size by number of channels
+  if( n_channels_active==0 ? event_size_no_header!=0 : event_size_no_header%n_channels_active != 0 ){
+    THROW(DigitizerData::DigitizerDataException, "Mismatch in data length and number of enabled channels");
+  }
+  unsigned int words_per_channel = n_channels_active ? event_size_no_header/n_channels_active : 0;
+
+  // there are two readings per word
+  m_n_samples = 2*words_per_channel;
+
+  // the channels follow the 4 word header in the order of their numbers
+  size_t next = 0;
+  for(size_t iChan=0; iChan<N_MAX_CHAN; iChan++){
+    if( !GetBit(m_channel_mask, static_cast<int>(iChan)) ) continue;
+#ifdef DIGITIZER_ZERO_COPY
+    m_offsets[iChan] = 2*(4 + next*words_per_channel);
+#else
+    m_offsets[iChan] = next*m_n_samples;
+#endif
+    next++;
+  }
+
+#ifndef DIGITIZER_ZERO_COPY
+  // the top half of each word is the second sample of the pair, the bottom half the first one
+  m_unpacked.resize(next*m_n_samples);
+  for(size_t iWord=0; iWord<event_size_no_header; iWord++){
+    m_unpacked[2*iWord]   = static_cast<uint16_t>(data[4+iWord] & 0x0000FFFF);  // sample[n]
+    m_unpacked[2*iWord+1] = static_cast<uint16_t>(data[4+iWord] >> 16);         // sample[n+1]
+  }
+#endif
+}
+
+struct DigitizerDataFragment { 
+
+  typedef DigitizerData::ChannelView ChannelView;
+
+////////////////////////////////////////////////////
+/// Constructor for creating a parsed digitizer event fragment
+////////////////////////////////////////////////////  
+  DigitizerDataFragment( const uint32_t *data, size_t size ) : DigitizerDataFragment() {
+    Decode(data, size);
+  }
+
+  protected:
+////////////////////////////////////////////////////
+/// Empty fragment, to be filled with Decode()
+////////////////////////////////////////////////////
+  DigitizerDataFragment() : event{}, m_size(0), m_stride(0) {}
+
+////////////////////////////////////////////////////
+/// Replace the content by the decoding of new data, reusing the sample buffer
+////////////////////////////////////////////////////
+  void Decode( const uint32_t *data, size_t size ) {
+    m_size = size;
+
+    // header checks and the location of the samples of each channel
+    DigitizerView view(data, size);
+    event.event_size            = view.event_size();
+    event.board_id              = view.board_id();
+    event.board_fail_flag       = view.board_fail_flag();
+    event.pattern_trig_options  = static_cast<uint16_t>(view.pattern_trig_options());
+    event.channel_mask          = static_cast<uint16_t>(view.channel_mask());
+    event.event_counter         = view.event_counter();
+    event.trigger_time_tag      = view.trigger_time_tag();
+    event.n_samples             = view.n_samples();
+
+    // all channels get a row of the sample buffer, padded to keep every row aligned.
+    // The buffer only grows, so a decoder reused for similar events does not allocate
+    m_stride = (event.n_samples + SAMPLES_PER_ALIGNMENT - 1) / SAMPLES_PER_ALIGNMENT * SAMPLES_PER_ALIGNMENT;
+    if (m_samples.size() < N_MAX_CHAN*m_stride) m_samples.resize(N_MAX_CHAN*m_stride);
+
+    for(int iChan=0; iChan<N_MAX_CHAN; iChan++){
+      // only fill it if it is enabled
+      if( GetBit(event.channel_mask,iChan)==0 || event.n_samples==0 )
+        continue;
+      ChannelView samples = view.channel_adc_counts(iChan);
+      memcpy(m_samples.data() + static_cast<size_t>(iChan)*m_stride, samples.data(), samples.size()*sizeof(uint16_t));
     }
       
   }
@@ -126,6 +264,7 @@ struct DigitizerDataFragment {
 /// - The number of samples in all channels with event data (as specified in the
 ///   channel mask) have the same number of samples
 ////////////////////////////////////////////////////
+  public:
   bool valid() const {
     bool validityFlag = true; // assume innocence until proven guilty
     
@@ -193,19 +332,22 @@ struct DigitizerDataFragment {
 ////////////////////////////////////////////////////
 /// Retrieves a copy of the full ADC count structure for all channels. This is available for completeness
 /// but it is recommended to retrieve data from a single channel at a time using the channel_adc_counts()
-/// function which simply provides a reference 
+/// function which does not copy anything
 ////////////////////////////////////////////////////
-    std::map<int, std::vector<uint16_t> > adc_counts() const { return event.adc_counts; }
+    std::map<int, std::vector<uint16_t> > adc_counts() const {
+      std::map<int, std::vector<uint16_t> > counts;
+      for(int iChan=0; iChan<N_MAX_CHAN; iChan++) counts[iChan] = channel_adc_counts(iChan);
+      return counts;
+    }
     
 ////////////////////////////////////////////////////
-/// Retrieves the data for a single channel, regardless of whether that channel was enabled for reading.
-/// If it was not enabled, it will print a WARNING to the screen but proceed to give you empty data.
+/// Retrieves a view of the data for a single channel, regardless of whether that channel was enabled for reading.
+/// If it was not enabled, the view is empty.
 ////////////////////////////////////////////////////
-    const std::vector<uint16_t>& channel_adc_counts(int channel) const {
+    ChannelView channel_adc_counts(int channel) const {
       
-      // verify that the channel requested is in the map of adc counts
-      if( event.adc_counts.find(channel)==event.adc_counts.end()){
-	//        ERROR("You are requesting data for channel "<<channel<<" for which there is no entry in the adc counts map.");
+      // verify that the channel requested exists
+      if( channel<0 || channel>=N_MAX_CHAN ){
         THROW(DigitizerData::DigitizerDataException, "The requested channel is not in the adc counts map.");
       }
       
@@ -213,10 +355,17 @@ struct DigitizerDataFragment {
       //if( GetBit(event.channel_mask, channel)==false ){
 	//WARNING("You are requesting data for channel "<<channel<<" which was not enabled for reading in data taking.  Are you sure you want to use this?");
       //}
+      if( !channel_has_data(channel) ) return ChannelView();
       
-      return event.adc_counts.find(channel)->second;
+      return ChannelView(m_samples.data() + static_cast<size_t>(channel)*m_stride, event.n_samples);
     
     }
+
+////////////////////////////////////////////////////
+/// Retrieves the distance in samples between the starts of consecutive channels in the sample buffer.
+/// Each channel starts on a 32 byte boundary.
+////////////////////////////////////////////////////
+    size_t sample_stride() const { return m_stride; }
     
 ////////////////////////////////////////////////////
 /// Helper function to let you determine if a given channel has data stored after decoding the event
@@ -247,12 +396,27 @@ struct DigitizerDataFragment {
       uint32_t trigger_time_tag;
       
       unsigned int n_samples;
-      std::map<int, std::vector<uint16_t> > adc_counts;
     } event;
+    static const size_t SAMPLE_ALIGNMENT = 32; // bytes
+    static const size_t SAMPLES_PER_ALIGNMENT = SAMPLE_ALIGNMENT / sizeof(uint16_t);
+    std::vector<uint16_t, DigitizerData::AlignedAllocator<uint16_t, SAMPLE_ALIGNMENT> > m_samples; // [N_MAX_CHAN][m_stride]
     size_t m_size; // number of words in full fragment
+    size_t m_stride; // samples per channel in m_samples, n_samples rounded up to keep channels aligned
     bool m_debug = false;
 };
 
+////////////////////////////////////////////////////
+/// Digitizer decoder to be reused for many fragments. decode() replaces the
+/// content of the previous fragment and keeps the sample buffer, so after the
+/// first fragment decoding does not allocate memory any more.
+////////////////////////////////////////////////////
+class DigitizerDecoder : public DigitizerDataFragment {
+  public:
+    DigitizerDecoder() {}
+
+    void decode( const uint32_t *data, size_t size ) { Decode(data, size); }
+};
+
 inline std::ostream &operator<<(std::ostream &out, const DigitizerDataFragment &event) {
   try {
     out<<"Digitizer Fragment"<<std::endl
@@ -276,7 +440,7 @@ inline std::ostream &operator<<(std::ostream &out, const DigitizerDataFragment &
       out<<std::setw(10)<<std::dec<<iSamp<<"|";
       for(int iChan=0; iChan<N_MAX_CHAN; iChan++){
         if( event.channel_has_data(iChan) ){
-          out<<std::setw(9)<<std::dec<<event.adc_counts()[iChan].at(iSamp);
+          out<<std::setw(9)<<std::dec<<event.channel_adc_counts(iChan).at(iSamp);
         }
         else{
           out<<std::setw(9)<<" - ";
@@ -0,0 +1,199 @@
+/*
+  Copyright (C) 2019-2020 CERN for the benefit of the FASER collaboration
+*/
+
+///////////////////////////////////////////////////////////////////
+// EventAssembler.hpp, (c) FASER Detector software
+///////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "EventFormats/DAQFormats.hpp"
+
+namespace DAQFormats {
+
+  /** \brief Builds events from fragments arriving from many threads
+   *
+   *  Fragments are grouped by event_id in a table split into shards, each with
+   *  its own lock, so producers adding fragments of different events rarely
+   *  wait for each other. An event is handed to the callback as soon as
+   *  fragments from all expected sources have arrived. Events still waiting
+   *  after the timeout are handed out by expire() with IncompleteTag and the
+   *  MissingFragment status.
+   *
+   *  A second fragment from the same source is dropped and the event gets
+   *  DuplicateTag (unless incomplete) and the DuplicateFragment status.
+   *  Fragments from sources that are not expected are added to the event but
+   *  not waited for. Fragments arriving after their event was handed out
+   *  start a new event, which will time out.
+   *
+   *  The callback is called without holding any lock, from the thread that
+   *  completed the event, so it has to be thread-safe itself.
+   */
+  class EventAssembler {
+  public:
+    using Clock = std::chrono::steady_clock;
+    using Callback = std::function<void(std::unique_ptr<EventFull>)>;
+
+    static const size_t MaxSources = 64;
+
+    EventAssembler(const std::vector<uint32_t>& expectedSources, unsigned int runNumber,
+		   std::chrono::microseconds timeout, Callback callback, size_t nShards=64) :
+      m_expected(expectedSources), m_runNumber(runNumber), m_timeout(timeout),
+      m_callback(std::move(callback)), m_shards(nShards ? nShards : 1),
+      m_nextCounter(0), m_nComplete(0), m_nIncomplete(0), m_nDuplicates(0) {
+      std::sort(m_expected.begin(), m_expected.end());
+      m_expected.erase(std::unique(m_expected.begin(), m_expected.end()), m_expected.end());
+      if (m_expected.empty() || m_expected.size()>MaxSources)
+	THROW(EFormatException,"Number of expected sources must be between 1 and "+std::to_string(MaxSources));
+    }
+
+    // prohibit copy and assign
+    EventAssembler(const EventAssembler& other) = delete;
+    EventAssembler& operator=(const EventAssembler& other) = delete;
+
+    /** \brief Add fragment, can be called from any thread
+     *
+     *  Ownership is taken of fragment, i.e. don't delete it later
+     */
+    void add(const EventFragment* fragment) {
+      std::unique_ptr<const EventFragment> owned(fragment);
+      std::unique_ptr<EventFull> done;
+      Shard& shard=shardOf(fragment->event_id());
+      {
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	auto it=shard.pending.find(fragment->event_id());
+	if (it==shard.pending.end()) {
+	  Pending pending;
+	  pending.event.reset(new EventFull(fragment->fragment_tag(), m_runNumber, m_nextCounter++));
+	  pending.start=Clock::now();
+	  it=shard.pending.emplace(fragment->event_id(), std::move(pending)).first;
+	}
+	Pending& pending=it->second;
+	if (pending.event->find_fragment(fragment->source_id())) {
+	  pending.duplicate=true;
+	  return; // owned deletes the duplicate
+	}
+	pending.event->addFragment(owned.get());
+	owned.release(); // the event owns it once added
+	size_t index=sourceIndex(fragment->source_id());
+	if (index<m_expected.size()) pending.seen.set(index);
+	if (pending.seen.count()==m_expected.size()) {
+	  done=std::move(pending.event);
+	  bool duplicate=pending.duplicate;
+	  shard.pending.erase(it);
+	  finish(*done, false, duplicate);
+	}
+      }
+      if (done) m_callback(std::move(done));
+    }
+
+    /// Hand out all events that have been waiting longer than the timeout, returns their number
+    size_t expire(Clock::time_point now=Clock::now()) {
+      return release([this, now](const Pending& pending) { return now-pending.start>=m_timeout; });
+    }
+
+    /// Hand out all events still waiting, e.g. at the end of a run
+    size_t flush() {
+      return release([](const Pending&) { return true; });
+    }
+
+    /// Number of events waiting for fragments
+    size_t pending() const {
+      size_t count=0;
+      for(const Shard& shard : m_shards) {
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	count+=shard.pending.size();
+      }
+      return count;
+    }
+
+    uint64_t complete_events() const { return m_nComplete; }
+    uint64_t incomplete_events() const { return m_nIncomplete; }
+    uint64_t duplicate_events() const { return m_nDuplicates; }
+
+  private:
+    struct Pending {
+      std::unique_ptr<EventFull> event;
+      std::bitset<MaxSources> seen;
+      bool duplicate=false;
+      Clock::time_point start;
+    };
+
+    struct Shard {
+      mutable std::mutex mutex;
+      std::unordered_map<uint64_t, Pending> pending;
+    };
+
+    Shard& shardOf(uint64_t event_id) {
+      // consecutive event ids go to different shards
+      return m_shards[static_cast<size_t>(event_id%m_shards.size())];
+    }
+
+    /// Position of source in list of expected sources, or size of list if not expected
+    size_t sourceIndex(uint32_t source_id) const {
+      auto it=std::lower_bound(m_expected.begin(), m_expected.end(), source_id);
+      if (it==m_expected.end() || *it!=source_id) return m_expected.size();
+      return static_cast<size_t>(it-m_expected.begin());
+    }
+
+    /// Set tag and status of event that is handed out
+    void finish(EventFull& event, bool incomplete, bool duplicate) {
+      if (duplicate) {
+	event.updateStatus(EventStatus::DuplicateFragment);
+	m_nDuplicates++;
+      }
+      if (incomplete) {
+	event.updateStatus(EventStatus::MissingFragment);
+	event.set_event_tag(IncompleteTag);
+	m_nIncomplete++;
+      } else {
+	if (duplicate) event.set_event_tag(DuplicateTag);
+	m_nComplete++;
+      }
+    }
+
+    template <typename Predicate> size_t release(Predicate due) {
+      size_t count=0;
+      std::vector<std::unique_ptr<EventFull>> done;
+      for(Shard& shard : m_shards) {
+	{
+	  std::lock_guard<std::mutex> lock(shard.mutex);
+	  for(auto it=shard.pending.begin(); it!=shard.pending.end();) {
+	    if (!due(it->second)) {
+	      ++it;
+	      continue;
+	    }
+	    finish(*it->second.event, true, it->second.duplicate);
+	    done.push_back(std::move(it->second.event));
+	    it=shard.pending.erase(it);
+	  }
+	}
+	count+=done.size();
+	for(auto& event : done) m_callback(std::move(event));
+	done.clear();
+      }
+      return count;
+    }
+
+    std::vector<uint32_t> m_expected;
+    unsigned int m_runNumber;
+    std::chrono::microseconds m_timeout;
+    Callback m_callback;
+    std::vector<Shard> m_shards;
+    std::atomic<uint64_t> m_nextCounter;
+    std::atomic<uint64_t> m_nComplete;
+    std::atomic<uint64_t> m_nIncomplete;
+    std::atomic<uint64_t> m_nDuplicates;
+  };
+
+}
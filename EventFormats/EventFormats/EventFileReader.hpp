@@ -0,0 +1,144 @@
+/*
+  Copyright (C) 2019-2020 CERN for the benefit of the FASER collaboration
+*/
+
+///////////////////////////////////////////////////////////////////
+// EventFileReader.hpp, (c) FASER Detector software
+///////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "EventFormats/EventView.hpp"
+
+namespace DAQFormats {
+
+  /** \brief Memory-mapped reader for raw data files
+   *
+   *  The whole file is mapped read-only and events are handed out as EventViews
+   *  pointing into the mapping, so no event data is copied. Iterating gives the
+   *  events in file order:
+   *
+   *    EventFileReader reader(filename);
+   *    for(const EventView& event : reader) { ... }
+   *
+   *  Views are only valid as long as the reader exists.
+   *
+   *  Moving to the next event only needs the event header, so payloads are
+   *  never touched unless asked for. When only headers are needed, open the
+   *  file with HeadersOnly to switch off read-ahead, so that just the pages
+   *  holding event headers are read from disk.
+   */
+  class EventFileReader {
+  public:
+
+    /// Expected use of the file, given to the kernel as paging hint
+    enum Access {
+      Sequential,  ///< events and their payloads are read in order
+      HeadersOnly  ///< only event (and maybe fragment) headers are read
+    };
+
+    /// Forward iterator over the events in the file
+    class const_iterator {
+    public:
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = EventView;
+      using difference_type = std::ptrdiff_t;
+      using pointer = const EventView*;
+      using reference = const EventView&;
+
+      const_iterator() : m_reader(nullptr), m_offset(0) {}
+      const_iterator(const EventFileReader* reader, size_t offset) : m_reader(reader), m_offset(offset) {
+	load();
+      }
+
+      reference operator*() const { return m_current; }
+      pointer operator->() const { return &m_current; }
+
+      /// Position of the current event in the file
+      size_t offset() const { return m_offset; }
+
+      const_iterator& operator++() {
+	// a corrupt size would otherwise keep the iterator on the same event
+	if (m_current.size()<sizeof(EventHeader)) THROW(EFormatException,"Event size too small to move to next event");
+	m_offset+=m_current.size();
+	load();
+	return *this;
+      }
+
+      bool operator==(const const_iterator& other) const {
+	return (atEnd() && other.atEnd()) || (m_reader==other.m_reader && m_offset==other.m_offset);
+      }
+      bool operator!=(const const_iterator& other) const { return !(*this==other); }
+
+    private:
+      bool atEnd() const { return !m_reader || m_offset>=m_reader->size(); }
+      void load() {
+	if (atEnd()) m_current=EventView();
+	else m_current=m_reader->event_at(m_offset);
+      }
+
+      const EventFileReader* m_reader;
+      size_t m_offset;
+      EventView m_current;
+    };
+
+    /// Map the given file, check is_open() for success
+    explicit EventFileReader(const std::string& filename, Access access=Sequential) : m_data(nullptr), m_size(0), m_open(false) {
+      int fd=open(filename.c_str(), O_RDONLY);
+      if (fd<0) return;
+      struct stat st;
+      if (fstat(fd, &st)==0 && S_ISREG(st.st_mode)) {
+	m_size=static_cast<size_t>(st.st_size);
+	if (m_size==0) {
+	  m_open=true;
+	} else {
+	  void* addr=mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	  if (addr!=MAP_FAILED) {
+	    m_data=static_cast<const uint8_t*>(addr);
+	    m_open=true;
+	    madvise(addr, m_size, access==HeadersOnly ? MADV_RANDOM : MADV_SEQUENTIAL);
+	  } else {
+	    m_size=0;
+	  }
+	}
+      }
+      close(fd); // mapping stays valid after closing the descriptor
+    }
+
+    ~EventFileReader() {
+      if (m_data) munmap(const_cast<uint8_t*>(m_data), m_size);
+    }
+
+    // prohibit copy and assign
+    EventFileReader(const EventFileReader& other) = delete;
+    EventFileReader& operator=(const EventFileReader& other) = delete;
+
+    bool is_open() const { return m_open; }
+
+    /// Start of the mapped file
+    const uint8_t * data() const { return m_data; }
+
+    /// Size of the file in bytes
+    size_t size() const { return m_size; }
+
+    /// Event starting at the given file offset
+    EventView event_at(size_t offset) const {
+      if (offset>=m_size) THROW(EFormatException,"Offset beyond end of file");
+      return EventView(m_data+offset, m_size-offset, true);
+    }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(); }
+
+  private:
+    const uint8_t* m_data;
+    size_t m_size;
+    bool m_open;
+  };
+
+}
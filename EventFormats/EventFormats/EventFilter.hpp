@@ -0,0 +1,118 @@
+/*
+  Copyright (C) 2019-2020 CERN for the benefit of the FASER collaboration
+*/
+
+///////////////////////////////////////////////////////////////////
+// EventFilter.hpp, (c) FASER Detector software
+///////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <map>
+#include <thread>
+#include <vector>
+#include "EventFormats/BoundedQueue.hpp"
+#include "EventFormats/EventFileReader.hpp"
+#include "EventFormats/EventIndex.hpp"
+#include "EventFormats/EventView.hpp"
+
+namespace DAQFormats {
+
+  /** \brief Run an event selection in a pipeline of worker threads
+   *
+   *  The index is cut into batches which the workers evaluate concurrently.
+   *  Results are put back in batch order before handing them to output, so
+   *  the output is identical to the one of a sequential loop over the index.
+   *
+   *  selection.listed(entry) tells if an index entry is looked at and
+   *  selection.select(reader, entry) returns its event, or an empty view if
+   *  it is not selected. output.add(event) is called in input order for each
+   *  listed entry and returns false to stop. An exception from the selection
+   *  or the output is rethrown once all threads are stopped.
+   */
+  template <typename Selection, typename Output>
+  void filterParallel(const EventFileReader& reader, const EventIndex& index,
+		      const Selection& selection, Output& output, unsigned int nThreads) {
+    const size_t batchSize = 256;
+
+    struct Batch {
+      size_t sequence;
+      size_t first;
+      size_t last;
+    };
+    struct Result {
+      size_t sequence;
+      std::vector<EventView> events; // listed events, empty view if not selected
+      std::exception_ptr error;
+    };
+
+    BoundedQueue<Batch> batches(2*nThreads);
+    BoundedQueue<Result> results(2*nThreads);
+    std::atomic<unsigned int> running(nThreads);
+
+    std::vector<std::thread> threads;
+    threads.emplace_back([&]() {
+      size_t sequence=0;
+      for(size_t first=0; first<index.size(); first+=batchSize) {
+	if (!batches.push(Batch{sequence++, first, std::min(first+batchSize, index.size())})) break;
+      }
+      batches.close();
+    });
+    for(unsigned int ii=0; ii<nThreads; ii++) {
+      threads.emplace_back([&]() {
+	Batch batch;
+	while (batches.pop(batch)) {
+	  Result result;
+	  result.sequence=batch.sequence;
+	  try {
+	    for(size_t jj=batch.first; jj<batch.last; jj++) {
+	      const EventIndexEntry& entry=index[jj];
+	      if (!selection.listed(entry)) continue;
+	      result.events.push_back(selection.select(reader, entry));
+	    }
+	  } catch (...) {
+	    result.error=std::current_exception();
+	  }
+	  if (!results.push(std::move(result))) break;
+	}
+	if (--running==0) results.close();
+      });
+    }
+
+    // Writer stage, reordering batches as needed. Threads are always joined before leaving
+    std::exception_ptr error;
+    try {
+      std::map<size_t, Result> pending;
+      size_t next=0;
+      bool stop=false;
+      Result result;
+      while (!stop && results.pop(result)) {
+	pending.emplace(result.sequence, std::move(result));
+	for(auto it=pending.find(next); !stop && it!=pending.end(); it=pending.find(next)) {
+	  for(const EventView& event : it->second.events) {
+	    if (!output.add(event)) {
+	      stop=true;
+	      break;
+	    }
+	  }
+	  if (!stop && it->second.error) {
+	    error=it->second.error;
+	    stop=true;
+	  }
+	  pending.erase(it);
+	  next++;
+	}
+      }
+    } catch (...) {
+      error=std::current_exception();
+    }
+    batches.close();
+    results.close();
+    for(auto& thread : threads) thread.join();
+    if (error) std::rethrow_exception(error);
+  }
+
+}
@@ -0,0 +1,227 @@
+/*
+  Copyright (C) 2019-2020 CERN for the benefit of the FASER collaboration
+*/
+
+///////////////////////////////////////////////////////////////////
+// EventIndex.hpp, (c) FASER Detector software
+///////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include "EventFormats/EventFileReader.hpp"
+
+namespace DAQFormats {
+
+  const uint32_t EventIndexMarker = 0x58444946; // "FIDX"
+  const uint16_t EventIndexVersionLatest = 0x0001;
+
+  /** \brief Header of a sidecar index file
+   *
+   *  file_size is the size of the raw file the index was made for and is used
+   *  to detect stale or partially written indices
+   */
+  struct EventIndexHeader {
+    uint32_t marker;
+    uint16_t version_number;
+    uint16_t entry_size;
+    uint64_t file_size;
+  }  __attribute__((__packed__));
+
+  /** \brief One event in a sidecar index file
+   *
+   *  Holds everything needed to select events without reading them
+   */
+  struct EventIndexEntry {
+    uint64_t offset;
+    uint32_t size;
+    uint8_t  event_tag;
+    uint8_t  reserved;
+    uint16_t trigger_bits;
+    uint16_t bc_id;
+    uint16_t status;
+    uint64_t event_counter;
+    uint64_t event_id;
+    uint64_t timestamp;
+  }  __attribute__((__packed__));
+
+  /// Fill index entry from the header of an event of given size found at the given file offset
+  inline EventIndexEntry makeIndexEntry(const EventHeader& header, uint64_t offset, uint32_t size) {
+    EventIndexEntry entry;
+    entry.offset        = offset;
+    entry.size          = size;
+    entry.event_tag     = header.event_tag;
+    entry.reserved      = 0;
+    entry.trigger_bits  = header.trigger_bits;
+    entry.bc_id         = header.bc_id;
+    entry.status        = header.status;
+    entry.event_counter = header.event_counter;
+    entry.event_id      = header.event_id;
+    entry.timestamp     = header.timestamp;
+    return entry;
+  }
+
+  /// Fill index entry for an event found at the given file offset
+  inline EventIndexEntry makeIndexEntry(const EventView& event, uint64_t offset) {
+    return makeIndexEntry(event.event_header(), offset, event.size());
+  }
+
+  /// Default name of the sidecar index for a raw data file
+  inline std::string indexFileName(const std::string& rawFileName) {
+    return rawFileName+".idx";
+  }
+
+  /** \brief Streaming writer for sidecar index files
+   *
+   *  Entries are appended as events are written. The raw file size is only
+   *  filled in by close(), so an index that was not closed is never accepted.
+   */
+  class EventIndexWriter {
+  public:
+    explicit EventIndexWriter(const std::string& filename) :
+      m_out(filename, std::ios::out | std::ios::binary | std::ios::trunc) {
+      if (!m_out.is_open()) THROW(EFormatException,"Can't open index file "+filename);
+      writeHeader(0);
+    }
+
+    /// Append entry for the next event
+    void add(const EventIndexEntry& entry) {
+      m_out.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+      if (m_out.fail()) THROW(EFormatException,"Failed to write index entry");
+    }
+
+    /// Mark index as complete for a raw file of the given size
+    void close(uint64_t fileSize) {
+      if (!m_out.is_open()) return;
+      m_out.seekp(0);
+      writeHeader(fileSize);
+      m_out.close();
+    }
+
+  private:
+    void writeHeader(uint64_t fileSize) {
+      EventIndexHeader header;
+      header.marker = EventIndexMarker;
+      header.version_number = EventIndexVersionLatest;
+      header.entry_size = sizeof(EventIndexEntry);
+      header.file_size = fileSize;
+      m_out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      if (m_out.fail()) THROW(EFormatException,"Failed to write index header");
+    }
+
+    std::ofstream m_out;
+  };
+
+  /** \brief Index of the events in a raw data file
+   *
+   *  Either loaded from a sidecar file or built with a single pass over the
+   *  event headers, without touching the payloads
+   */
+  class EventIndex {
+  public:
+    EventIndex() : m_complete(true) {}
+
+    /** \brief Build index by scanning the event headers
+     *
+     *  Scanning stops at the first corrupted event. The events before it are
+     *  kept and complete() returns false with the problem in error().
+     */
+    void build(const EventFileReader& reader) {
+      m_entries.clear();
+      m_complete=true;
+      m_error.clear();
+      try {
+	for(auto it=reader.begin(); it!=reader.end(); ++it) {
+	  m_entries.push_back(makeIndexEntry(*it, it.offset()));
+	}
+      } catch (EFormatException &e) {
+	m_complete=false;
+	m_error=e.what();
+      }
+    }
+
+    /// Load index from file, returns false if missing or not made for a raw file of this size
+    bool load(const std::string& filename, uint64_t fileSize) {
+      m_entries.clear();
+      m_complete=true;
+      m_error.clear();
+      std::ifstream in(filename, std::ios::binary | std::ios::ate);
+      if (!in.is_open()) return false;
+      std::streamoff indexSize=in.tellg();
+      in.seekg(0);
+      EventIndexHeader header;
+      in.read(reinterpret_cast<char*>(&header), sizeof(header));
+      if (in.fail() || header.marker!=EventIndexMarker || header.version_number!=EventIndexVersionLatest ||
+	  header.entry_size!=sizeof(EventIndexEntry) || header.file_size!=fileSize) return false;
+      size_t dataSize=static_cast<size_t>(indexSize)-sizeof(header);
+      if (dataSize%sizeof(EventIndexEntry)) return false;
+      m_entries.resize(dataSize/sizeof(EventIndexEntry));
+      in.read(reinterpret_cast<char*>(m_entries.data()), static_cast<std::streamsize>(dataSize));
+      if (in.fail()) {
+	m_entries.clear();
+	return false;
+      }
+      return true;
+    }
+
+    /// Write complete index to file
+    void save(const std::string& filename, uint64_t fileSize) const {
+      if (!m_complete) THROW(EFormatException,"Can't save index of corrupted file");
+      EventIndexWriter writer(filename);
+      for(const auto& entry : m_entries) writer.add(entry);
+      writer.close(fileSize);
+    }
+
+    /** \brief Check the index against the events in the file read by reader
+     *
+     *  The file size alone does not catch a file that was rewritten or replaced
+     *  with one of the same size, so the first and last indexed events are
+     *  compared with the file and must cover it completely.
+     */
+    bool matches(const EventFileReader& reader) const {
+      if (m_entries.empty()) return reader.size()==0;
+      const EventIndexEntry& last=m_entries.back();
+      if (m_entries.front().offset!=0 || last.offset+last.size!=reader.size()) return false;
+      try {
+	for(const EventIndexEntry* entry : {&m_entries.front(), &last}) {
+	  EventView event=reader.event_at(entry->offset);
+	  EventIndexEntry fromFile=makeIndexEntry(event, entry->offset);
+	  if (memcmp(&fromFile, entry, sizeof(fromFile))) return false;
+	}
+      } catch (EFormatException &) {
+	return false;
+      }
+      return true;
+    }
+
+    /** \brief Load sidecar index of the file read by reader, or build it if not valid
+     *
+     *  An index that does not match() the file is rebuilt. If writeIfMissing
+     *  is set, a newly built index is saved as sidecar file.
+     */
+    void open(const EventFileReader& reader, const std::string& rawFileName, bool writeIfMissing=false) {
+      if (load(indexFileName(rawFileName), reader.size()) && matches(reader)) return;
+      build(reader);
+      if (writeIfMissing && m_complete) save(indexFileName(rawFileName), reader.size());
+    }
+
+    bool complete() const { return m_complete; }
+    const std::string& error() const { return m_error; }
+
+    size_t size() const { return m_entries.size(); }
+    const EventIndexEntry& operator[](size_t ii) const { return m_entries[ii]; }
+
+    using const_iterator = std::vector<EventIndexEntry>::const_iterator;
+    const_iterator begin() const { return m_entries.begin(); }
+    const_iterator end() const { return m_entries.end(); }
+
+  private:
+    std::vector<EventIndexEntry> m_entries;
+    bool m_complete;
+    std::string m_error;
+  };
+
+}
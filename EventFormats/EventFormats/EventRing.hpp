@@ -0,0 +1,374 @@
+/*
+  Copyright (C) 2019-2020 CERN for the benefit of the FASER collaboration
+*/
+
+///////////////////////////////////////////////////////////////////
+// EventRing.hpp, (c) FASER Detector software
+///////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "EventFormats/DAQFormats.hpp"
+#include "EventFormats/EventView.hpp"
+
+namespace DAQFormats {
+
+  const uint32_t EventRingMarker = 0x474E5246; // "FRNG"
+  const uint16_t EventRingVersionLatest = 0x0002;
+
+  /** \brief Header at the start of a shared-memory event ring
+   *
+   *  Positions count bytes written since the ring was created and never wrap,
+   *  the offset in the data area is position modulo capacity. All records
+   *  between tail_pos and head_pos are intact. capacity and instance never
+   *  change once the marker is set.
+   */
+  struct EventRingHeader {
+    uint32_t marker;
+    uint16_t version_number;
+    uint16_t header_size;
+    uint64_t capacity;                ///< size of data area following the header
+    uint64_t instance;                ///< different for every writer that created the ring
+    std::atomic<uint64_t> head_pos;   ///< end of last complete record
+    std::atomic<uint64_t> tail_pos;   ///< start of oldest record not (being) overwritten
+    std::atomic<uint64_t> last_pos;   ///< start of newest record
+    std::atomic<uint64_t> records;    ///< number of records written
+  };
+
+  /// Header of each record in the ring, followed by the encoded event
+  struct EventRingRecord {
+    uint32_t size;      ///< size of record including this header and padding
+    uint32_t kind;      ///< EventRecord or PaddingRecord
+    uint64_t sequence;  ///< number of the record, counting from 0
+  };
+
+  static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared ring needs lock-free 64-bit atomics");
+
+  /** \brief Producer side of a shared-memory broadcast ring of events
+   *
+   *  Events are copied into a POSIX shared memory segment, from which any
+   *  number of EventRingReaders can read them without copying. The writer
+   *  never waits for readers: when the ring is full the oldest events are
+   *  overwritten, and readers that fall behind skip them. Events larger than
+   *  half the ring are refused.
+   *
+   *  A restarted writer creates a new segment under the same name instead of
+   *  reusing the old one, so readers still attached to the old segment are
+   *  not disturbed. They see no new events there and have to attach again,
+   *  EventRingReader::replaced() tells when.
+   */
+  class EventRingWriter {
+  public:
+    static const uint32_t EventRecord = 1;
+    static const uint32_t PaddingRecord = 2;
+    static const size_t Alignment = sizeof(EventRingRecord);
+
+    /** \brief Create ring with the given name, e.g. "/faser-monitoring"
+     *
+     *  An existing segment of that name, for example left by a crashed writer,
+     *  is unlinked and a new one created. Capacity is rounded up to a multiple
+     *  of 16 bytes. If unlinkOnClose is set, the segment is removed when the
+     *  writer goes away, unless the name was taken over by a newer writer;
+     *  readers that still have it mapped are not affected.
+     */
+    EventRingWriter(const std::string& name, size_t capacity, bool unlinkOnClose=true) :
+      m_name(name), m_unlink(unlinkOnClose), m_header(nullptr), m_data(nullptr), m_mapSize(0) {
+      capacity=align(capacity);
+      shm_unlink(name.c_str());
+      int fd=shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+      if (fd<0) THROW(EFormatException,"Can't create shared memory "+name);
+      m_mapSize=sizeof(EventRingHeader)+capacity;
+      void* addr=MAP_FAILED;
+      struct stat st;
+      if (fstat(fd, &st)==0 && ftruncate(fd, static_cast<off_t>(m_mapSize))==0)
+	addr=mmap(nullptr, m_mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      close(fd);
+      if (addr==MAP_FAILED) {
+	shm_unlink(name.c_str());
+	THROW(EFormatException,"Can't map shared memory "+name);
+      }
+      m_inode=st.st_ino;
+      m_header=static_cast<EventRingHeader*>(addr);
+      m_data=static_cast<uint8_t*>(addr)+sizeof(EventRingHeader);
+      // the new segment is zero-filled, readers ignore it until the marker is set
+      m_header->version_number=EventRingVersionLatest;
+      m_header->header_size=sizeof(EventRingHeader);
+      m_header->capacity=capacity;
+      m_header->instance=static_cast<uint64_t>(std::chrono::system_clock::now().time_since_epoch().count())^
+	(static_cast<uint64_t>(getpid())<<40);
+      m_header->head_pos.store(0);
+      m_header->tail_pos.store(0);
+      m_header->last_pos.store(0);
+      m_header->records.store(0);
+      std::atomic_thread_fence(std::memory_order_release);
+      m_header->marker=EventRingMarker;
+    }
+
+    ~EventRingWriter() {
+      if (m_header) munmap(m_header, m_mapSize);
+      if (m_unlink && ownsName()) shm_unlink(m_name.c_str());
+    }
+
+    // prohibit copy and assign
+    EventRingWriter(const EventRingWriter& other) = delete;
+    EventRingWriter& operator=(const EventRingWriter& other) = delete;
+
+    /// Copy encoded event into the ring
+    void write(const EventView& event) {
+      uint8_t* dest=reserve(event.size());
+      memcpy(dest, event.data(), event.size());
+      commit();
+    }
+
+    /// Encode event straight into the ring
+    void write(const EventFull& event) {
+      uint8_t* dest=reserve(event.encoded_size());
+      event.serialize_into(dest, event.encoded_size());
+      commit();
+    }
+
+    size_t capacity() const { return m_header->capacity; }
+    uint64_t records() const { return m_header->records.load(std::memory_order_relaxed); }
+    uint64_t instance() const { return m_header->instance; }
+
+  private:
+    /// True if the name still refers to the segment made by this writer
+    bool ownsName() const {
+      int fd=shm_open(m_name.c_str(), O_RDONLY, 0);
+      if (fd<0) return false;
+      struct stat st;
+      bool same=fstat(fd, &st)==0 && st.st_ino==m_inode;
+      close(fd);
+      return same;
+    }
+
+    struct Span {
+      uint64_t start;
+      uint64_t end;
+    };
+
+    static size_t align(size_t size) { return (size+Alignment-1)/Alignment*Alignment; }
+
+    /** \brief Make room for an event of the given size, returns where to put it
+     *
+     *  Records never wrap around the end of the data area, the rest of the
+     *  area is filled with a padding record instead.
+     */
+    uint8_t* reserve(size_t eventSize) {
+      const uint64_t capacity=m_header->capacity;
+      size_t recordSize=align(sizeof(EventRingRecord)+eventSize);
+      if (recordSize>capacity/2) THROW(EFormatException,"Event too large for shared ring");
+      uint64_t pos=m_header->head_pos.load(std::memory_order_relaxed);
+      uint64_t padding=0;
+      if (pos%capacity+recordSize>capacity) padding=capacity-pos%capacity;
+
+      // Move the tail past everything we are about to overwrite before touching the data
+      uint64_t end=pos+padding+recordSize;
+      while (!m_spans.empty() && m_spans.front().start+capacity<end) m_spans.pop_front();
+      m_header->tail_pos.store(m_spans.empty() ? pos+padding : m_spans.front().start, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+
+      if (padding) {
+	EventRingRecord* pad=recordAt(pos);
+	pad->size=static_cast<uint32_t>(padding);
+	pad->kind=PaddingRecord;
+	pad->sequence=0;
+	pos+=padding;
+      }
+      EventRingRecord* record=recordAt(pos);
+      record->size=static_cast<uint32_t>(recordSize);
+      record->kind=EventRecord;
+      record->sequence=m_header->records.load(std::memory_order_relaxed);
+      m_spans.push_back(Span{pos, pos+recordSize});
+      return reinterpret_cast<uint8_t*>(record+1);
+    }
+
+    /// Make the last reserved record visible to readers
+    void commit() {
+      const Span& span=m_spans.back();
+      m_header->last_pos.store(span.start, std::memory_order_release);
+      m_header->records.fetch_add(1, std::memory_order_release);
+      m_header->head_pos.store(span.end, std::memory_order_release);
+    }
+
+    EventRingRecord* recordAt(uint64_t pos) {
+      return reinterpret_cast<EventRingRecord*>(m_data+pos%m_header->capacity);
+    }
+
+    std::string m_name;
+    bool m_unlink;
+    EventRingHeader* m_header;
+    uint8_t* m_data;
+    size_t m_mapSize;
+    ino_t m_inode;
+    std::deque<Span> m_spans; ///< records currently in the ring
+  };
+
+  /** \brief Consumer side of a shared-memory event ring
+   *
+   *  Each reader keeps its own position and never slows down the writer.
+   *  Events are returned as EventViews pointing straight into the shared
+   *  segment. Since the writer may overwrite an event while it is being
+   *  looked at, call still_valid() after using a view and discard whatever
+   *  was derived from it if that returns false:
+   *
+   *    EventRingReader ring("/faser-monitoring");
+   *    EventView event;
+   *    while (running) {
+   *      if (!ring.next(event)) { wait a bit; continue; }
+   *      ... fill histograms ...
+   *      if (!ring.still_valid()) ... discard ...
+   *    }
+   *
+   *  With AllEvents every event is returned unless the reader falls more than
+   *  the ring size behind, with LatestEvent the reader jumps to the newest
+   *  event on every call, sampling the stream at its own pace.
+   *
+   *  A reader stays on the segment it attached to. When the writer is
+   *  restarted no new events arrive there; check replaced() while idle and
+   *  create a new reader when it returns true.
+   */
+  class EventRingReader {
+  public:
+    enum Policy { AllEvents, LatestEvent };
+
+    /// Attach to existing ring, check is_open() for success
+    explicit EventRingReader(const std::string& name, Policy policy=AllEvents) :
+      m_name(name), m_policy(policy), m_header(nullptr), m_data(nullptr), m_mapSize(0), m_capacity(0), m_instance(0),
+      m_pos(0), m_current(0), m_nextSequence(0), m_missed(0) {
+      int fd=shm_open(name.c_str(), O_RDONLY, 0);
+      if (fd<0) return;
+      struct stat st;
+      if (fstat(fd, &st)==0 && static_cast<size_t>(st.st_size)>=sizeof(EventRingHeader)) {
+	m_mapSize=static_cast<size_t>(st.st_size);
+	void* addr=mmap(nullptr, m_mapSize, PROT_READ, MAP_SHARED, fd, 0);
+	if (addr!=MAP_FAILED) {
+	  m_header=static_cast<const EventRingHeader*>(addr);
+	  m_data=static_cast<const uint8_t*>(addr)+sizeof(EventRingHeader);
+	}
+      }
+      close(fd);
+      if (m_header && (m_header->marker!=EventRingMarker || m_header->version_number!=EventRingVersionLatest ||
+		       sizeof(EventRingHeader)+m_header->capacity>m_mapSize)) {
+	munmap(const_cast<EventRingHeader*>(m_header), m_mapSize);
+	m_header=nullptr;
+	return;
+      }
+      if (m_header) {
+	m_capacity=m_header->capacity;
+	m_instance=m_header->instance;
+	resync();
+      }
+    }
+
+    ~EventRingReader() {
+      if (m_header) munmap(const_cast<EventRingHeader*>(m_header), m_mapSize);
+    }
+
+    // prohibit copy and assign
+    EventRingReader(const EventRingReader& other) = delete;
+    EventRingReader& operator=(const EventRingReader& other) = delete;
+
+    bool is_open() const { return m_header!=nullptr; }
+
+    /// True if the name now refers to a ring of another writer, attach again to read it
+    bool replaced() const {
+      int fd=shm_open(m_name.c_str(), O_RDONLY, 0);
+      if (fd<0) return false;
+      bool newer=false;
+      void* addr=mmap(nullptr, sizeof(EventRingHeader), PROT_READ, MAP_SHARED, fd, 0);
+      close(fd);
+      if (addr!=MAP_FAILED) {
+	const EventRingHeader* header=static_cast<const EventRingHeader*>(addr);
+	std::atomic_thread_fence(std::memory_order_acquire);
+	newer=header->marker==EventRingMarker && header->version_number==EventRingVersionLatest &&
+	  header->instance!=m_instance;
+	munmap(addr, sizeof(EventRingHeader));
+      }
+      return newer;
+    }
+
+    /** \brief Get next event, returns false if there is none yet
+     *
+     *  The view stays usable until the next call, as long as still_valid() is true.
+     *  Throws if the ring was reinitialized or holds a corrupted record
+     */
+    bool next(EventView& event) {
+      const uint64_t capacity=m_capacity;
+      while (true) {
+	uint64_t head=m_header->head_pos.load(std::memory_order_acquire);
+	if (head<m_pos || m_header->capacity!=m_capacity || m_header->instance!=m_instance)
+	  THROW(EFormatException,"Shared ring was reinitialized in place, attach again");
+	if (m_policy==LatestEvent) {
+	  uint64_t last=m_header->last_pos.load(std::memory_order_acquire);
+	  if (head>m_pos && last>m_pos) m_pos=last;
+	}
+	if (m_pos>=head) return false;
+	if (m_pos<m_header->tail_pos.load(std::memory_order_acquire)) {
+	  m_pos=m_header->tail_pos.load(std::memory_order_acquire); // overwritten, skip ahead
+	  continue;
+	}
+	const EventRingRecord* record=reinterpret_cast<const EventRingRecord*>(m_data+m_pos%capacity);
+	uint32_t size=record->size;
+	uint32_t kind=record->kind;
+	uint64_t sequence=record->sequence;
+	m_current=m_pos;
+	if (!still_valid()) continue; // overwritten while reading, retried from tail
+	if (size<sizeof(EventRingRecord) || size>capacity-m_pos%capacity)
+	  THROW(EFormatException,"Corrupted record in shared ring");
+	m_pos+=size;
+	if (kind!=EventRingWriter::EventRecord) continue;
+	try {
+	  event=EventView(reinterpret_cast<const uint8_t*>(record+1), size-sizeof(EventRingRecord), true);
+	} catch (EFormatException &) {
+	  if (still_valid()) throw;
+	  continue;
+	}
+	if (sequence>m_nextSequence) m_missed+=sequence-m_nextSequence;
+	m_nextSequence=sequence+1;
+	return true;
+      }
+    }
+
+    /// True if the event returned last by next() has not been overwritten since
+    bool still_valid() const {
+      std::atomic_thread_fence(std::memory_order_acquire);
+      return m_current>=m_header->tail_pos.load(std::memory_order_relaxed);
+    }
+
+    /// Number of events skipped, because they were overwritten or by sampling
+    uint64_t missed() const { return m_missed; }
+
+  private:
+    /// Start reading at the newest event
+    void resync() {
+      m_pos=m_header->last_pos.load(std::memory_order_acquire);
+      m_nextSequence=0;
+      m_current=m_pos;
+      if (m_header->head_pos.load(std::memory_order_acquire)==0) return;
+      const EventRingRecord* record=reinterpret_cast<const EventRingRecord*>(m_data+m_pos%m_capacity);
+      m_nextSequence=record->sequence;
+    }
+
+    std::string m_name;
+    Policy m_policy;
+    const EventRingHeader* m_header;
+    const uint8_t* m_data;
+    size_t m_mapSize;
+    uint64_t m_capacity;     ///< capacity when attaching, checked against the mapped size
+    uint64_t m_instance;
+    uint64_t m_pos;          ///< position of next record to read
+    uint64_t m_current;      ///< position of record returned last
+    uint64_t m_nextSequence;
+    uint64_t m_missed;
+  };
+
+}
@@ -0,0 +1,468 @@
+/*
+  Copyright (C) 2019-2020 CERN for the benefit of the FASER collaboration
+*/
+
+///////////////////////////////////////////////////////////////////
+// EventSelection.hpp, (c) FASER Detector software
+///////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <array>
+#include <cctype>
+#include <cstring>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+#include "EventFormats/EventView.hpp"
+#include "EventFormats/TLBDataFragment.hpp"
+#include "EventFormats/BOBRDataFragment.hpp"
+#include "EventFormats/DigitizerDataFragment.hpp"
+#include "EventFormats/TrackerDataFragment.hpp"
+
+CREATE_EXCEPTION_TYPE(ESelectionException,DAQFormats)
+namespace DAQFormats {
+
+  /** \brief Event selection given by an expression on header and decoded quantities
+   *
+   *  Expressions combine integer quantities with the C operators
+   *  || && ! == != < <= > >= | & and parentheses, e.g.
+   *
+   *    "(tlb.tap & 0x4) && trk.hits[1] >= 5 && digi.peak[3] > 200"
+   *
+   *  Unlike in C, & and | bind tighter than comparisons. Available quantities:
+   *
+   *    event_tag, trigger_bits, bc_id, status, event_id, event_counter,
+   *    run_number, timestamp        from the event header
+   *    tlb.tap, tlb.tbp, tlb.input_bits
+   *                                 from the TLB physics fragment
+   *    bobr.machinemode, bobr.fillnumber, bobr.beam1_intensity, bobr.beam2_intensity
+   *                                 from the BOBR fragment
+   *    trk.hits, trk.hits[station]  decoded tracker hits in total or per station,
+   *                                 with the TRB to station mapping of the run
+   *                                 from CablingDB, none before run 429
+   *    digi.peak[ch], digi.min[ch], digi.max[ch]
+   *                                 digitizer channel samples, peak being the
+   *                                 height of the (negative) pulse above the
+   *                                 baseline from the first samples
+   *
+   *  A fragment is only decoded when the expression asks for one of its
+   *  quantities, and && and || stop evaluating as soon as the result is known.
+   *  Quantities of missing or undecodable fragments are 0.
+   *
+   *  select() does not modify the object, so one selection can be used by
+   *  several threads at once.
+   */
+  class EventSelection {
+  public:
+    enum Detector { Header, TLB, BOBR, Tracker, Digitizer, NumDetectors };
+
+    explicit EventSelection(const std::string& expression) : m_expression(expression), m_pos(0), m_used(0) {
+      m_root=parseOr();
+      skipSpace();
+      if (m_pos!=m_expression.size()) syntaxError("unexpected '"+m_expression.substr(m_pos)+"'");
+    }
+
+    /// True if the event passes the selection
+    bool select(const EventView& event) const { return evaluate(event)!=0; }
+
+    /// Value of the expression for the given event
+    int64_t evaluate(const EventView& event) const {
+      Decoded decoded(event);
+      return evaluate(m_root, decoded);
+    }
+
+    const std::string& expression() const { return m_expression; }
+
+    /// True if quantities of the given detector are used in the expression
+    bool uses(Detector detector) const { return (m_used & (1u<<detector))!=0; }
+
+  private:
+    static const unsigned int NumStations = 4;
+    static const int BaselineSamples = 10;
+
+    enum Variable {
+      EventTag, TriggerBits, BCID, Status, EventID, EventCounter, RunNumber, Timestamp,
+      TLBTap, TLBTbp, TLBInputBits,
+      BOBRMachineMode, BOBRFillNumber, BOBRBeam1Intensity, BOBRBeam2Intensity,
+      TrackerHits, TrackerStationHits,
+      DigiPeak, DigiMin, DigiMax
+    };
+
+    struct VariableInfo {
+      const char* name;
+      Variable variable;
+      Detector detector;
+      unsigned int indices; ///< 0 for scalar quantities
+    };
+
+    enum Op { Constant, Load, Not, Or, And, BitOr, BitAnd, Equal, NotEqual, Less, LessEqual, Greater, GreaterEqual };
+
+    struct Node {
+      Op op;
+      int64_t value;  ///< constant, or index for Load
+      Variable variable;
+      int left;
+      int right;
+    };
+
+    /// Fragments of one event, decoded on first use
+    class Decoded {
+    public:
+      explicit Decoded(const EventView& event) : m_event(event), m_decoded(0), m_tlb{}, m_bobr{}, m_stationHits{},
+						 m_digitizer(nullptr) {}
+
+      const EventView& event() const { return m_event; }
+
+      const std::array<int64_t,3>& tlb() {
+	if (once(TLB) && m_event.event_tag()==PhysicsTag) {
+	  FragmentView frag=m_event.find_fragment(TriggerSourceID);
+	  if (frag) {
+	    try {
+	      TLBDataFormat::TLBDataFragment tlb(frag.payload<const uint32_t*>(), frag.payload_size());
+	      m_tlb={tlb.tap(), tlb.tbp(), tlb.input_bits()};
+	    } catch (TLBDataFormat::TLBDataException &) {
+	    }
+	  }
+	}
+	return m_tlb;
+      }
+
+      const std::array<int64_t,4>& bobr() {
+	if (once(BOBR)) {
+	  FragmentView frag=m_event.find_fragment(BOBRSourceID);
+	  if (frag) {
+	    try {
+	      BOBRDataFormat::BOBRDataFragment bobr(frag.payload<const uint32_t*>(), frag.payload_size());
+	      m_bobr={bobr.machinemode(), bobr.fillnumber(), bobr.beam1_intensity(), bobr.beam2_intensity()};
+	    } catch (BOBRDataFormat::BOBRDataException &) {
+	    }
+	  }
+	}
+	return m_bobr;
+      }
+
+      const std::array<int64_t,NumStations>& stationHits() {
+	if (once(Tracker)) {
+	  for(const FragmentView& frag : m_event) {
+	    if ((frag.source_id()&0xFFFF0000)!=TrackerSourceID) continue;
+	    int station=trbStation(m_event.run_number(), frag.source_id()&0xFFFF);
+	    if (station<0) continue;
+	    try {
+	      // only hits are needed, skip the checksum. One decoder per thread keeps its buffers between events
+	      static thread_local TrackerDecoder trk;
+	      trk.decode(frag.payload<const uint32_t*>(), frag.payload_size(), TrackerDataFragment::DecodeOnDemand);
+	      int64_t hits=0;
+	      for(size_t module=0; module<TrackerDataFragment::MODULES_PER_FRAGMENT; module++) {
+		if (trk.hasData(module)) hits+=trk[module].GetNHits();
+	      }
+	      m_stationHits[static_cast<size_t>(station)]+=hits;
+	    } catch (TrackerData::TrackerDataException &) {
+	    }
+	  }
+	}
+	return m_stationHits;
+      }
+
+      /// Digitizer fragment, nullptr if missing or corrupted
+      const DigitizerView* digitizer() {
+	if (once(Digitizer) && m_event.event_tag()==PhysicsTag) {
+	  FragmentView frag=m_event.find_fragment(PMTSourceID);
+	  if (frag) {
+	    try {
+	      // samples are read in place from the event
+	      m_digitizerView.set(frag.payload<const uint32_t*>(), frag.payload_size());
+	      m_digitizer=&m_digitizerView;
+	    } catch (DigitizerData::DigitizerDataException &) {
+	    }
+	  }
+	}
+	return m_digitizer;
+      }
+
+    private:
+      /// True the first time it is called for the given detector
+      bool once(Detector detector) {
+	if (m_decoded & (1u<<detector)) return false;
+	m_decoded|=(1u<<detector);
+	return true;
+      }
+
+      /** \brief Station read by a TRB in the given run, -1 if none
+       *
+       *  Copy of mappingData in CablingDB/cablingDB.py, giving the station of
+       *  TRBs 0 to 15 ('-' for none) from the first run of each entry on.
+       *  Keep the two in sync.
+       */
+      static int trbStation(uint32_t run, uint32_t trb) {
+	static const struct { uint32_t first_run; const char* stations; } cabling[]={
+	  {  429, "000-------------"},
+	  {  586, "------000-------"},
+	  { 1003, "000-------------"},
+	  { 1040, "------000-------"},
+	  { 1099, "000-------------"},
+	  { 1217, "---000----------"},
+	  { 1305, "---222----------"},
+	  { 1320, "111222----------"},
+	  { 1342, "111222333-------"},
+	  { 3284, "000-------------"},
+	  { 3287, "111222333-------"},
+	  { 3288, "000-------------"},
+	  { 4272, "111222333-------"},
+	  { 4359, "000-------------"},
+	  { 4399, "111222333-------"},
+	  { 4404, "000-------------"},
+	  { 4411, "111222333-------"},
+	  { 4418, "000-------------"},
+	  { 4439, "111222333-------"},
+	  { 4857, "000-------------"},
+	  { 4865, "111222333-------"},
+	  { 4875, "000-------------"},
+	  { 4892, "111222333-------"},
+	  { 4900, "-----------000--"},
+	  { 4912, "111222333-------"},
+	  { 4954, "-----------000--"},
+	  { 4989, "111222333-------"},
+	  { 4991, "-----------000--"},
+	  { 4993, "111222333-------"},
+	  { 4996, "-----------000--"},
+	  { 4997, "111222333-------"},
+	  { 5042, "-----------000--"},
+	  { 5050, "111222333-------"},
+	  { 5303, "111222333--000--"},
+	};
+	if (trb>=16) return -1;
+	const char* stations=nullptr;
+	for(const auto& entry : cabling) {
+	  if (entry.first_run>run) break;
+	  stations=entry.stations;
+	}
+	if (!stations || stations[trb]=='-') return -1;
+	return stations[trb]-'0';
+      }
+
+      const EventView& m_event;
+      unsigned int m_decoded;
+      std::array<int64_t,3> m_tlb;
+      std::array<int64_t,4> m_bobr;
+      std::array<int64_t,NumStations> m_stationHits;
+      DigitizerView m_digitizerView;
+      const DigitizerView* m_digitizer;
+    };
+
+    static const std::vector<VariableInfo>& variables() {
+      static const std::vector<VariableInfo> vars={
+	{"event_tag",            EventTag,           Header,    0},
+	{"trigger_bits",         TriggerBits,        Header,    0},
+	{"bc_id",                BCID,               Header,    0},
+	{"status",               Status,             Header,    0},
+	{"event_id",             EventID,            Header,    0},
+	{"event_counter",        EventCounter,       Header,    0},
+	{"run_number",           RunNumber,          Header,    0},
+	{"timestamp",            Timestamp,          Header,    0},
+	{"tlb.tap",              TLBTap,             TLB,       0},
+	{"tlb.tbp",              TLBTbp,             TLB,       0},
+	{"tlb.input_bits",       TLBInputBits,       TLB,       0},
+	{"bobr.machinemode",     BOBRMachineMode,    BOBR,      0},
+	{"bobr.fillnumber",      BOBRFillNumber,     BOBR,      0},
+	{"bobr.beam1_intensity", BOBRBeam1Intensity, BOBR,      0},
+	{"bobr.beam2_intensity", BOBRBeam2Intensity, BOBR,      0},
+	{"trk.hits",             TrackerHits,        Tracker,   0},
+	{"trk.hits",             TrackerStationHits, Tracker,   NumStations},
+	{"digi.peak",            DigiPeak,           Digitizer, N_MAX_CHAN},
+	{"digi.min",             DigiMin,            Digitizer, N_MAX_CHAN},
+	{"digi.max",             DigiMax,            Digitizer, N_MAX_CHAN},
+      };
+      return vars;
+    }
+
+    int64_t evaluate(int index, Decoded& decoded) const {
+      const Node& node=m_nodes[static_cast<size_t>(index)];
+      switch (node.op) {
+      case Constant:     return node.value;
+      case Load:         return load(node.variable, static_cast<size_t>(node.value), decoded);
+      case Not:          return !evaluate(node.left, decoded);
+      case Or:           return evaluate(node.left, decoded) || evaluate(node.right, decoded);
+      case And:          return evaluate(node.left, decoded) && evaluate(node.right, decoded);
+      case BitOr:        return evaluate(node.left, decoded) | evaluate(node.right, decoded);
+      case BitAnd:       return evaluate(node.left, decoded) & evaluate(node.right, decoded);
+      case Equal:        return evaluate(node.left, decoded) == evaluate(node.right, decoded);
+      case NotEqual:     return evaluate(node.left, decoded) != evaluate(node.right, decoded);
+      case Less:         return evaluate(node.left, decoded) < evaluate(node.right, decoded);
+      case LessEqual:    return evaluate(node.left, decoded) <= evaluate(node.right, decoded);
+      case Greater:      return evaluate(node.left, decoded) > evaluate(node.right, decoded);
+      case GreaterEqual: return evaluate(node.left, decoded) >= evaluate(node.right, decoded);
+      }
+      return 0;
+    }
+
+    static int64_t load(Variable variable, size_t index, Decoded& decoded) {
+      const EventView& event=decoded.event();
+      switch (variable) {
+      case EventTag:           return event.event_tag();
+      case TriggerBits:        return event.trigger_bits();
+      case BCID:               return event.bc_id();
+      case Status:             return event.event_header().status;
+      case EventID:            return static_cast<int64_t>(event.event_id());
+      case EventCounter:       return static_cast<int64_t>(event.event_counter());
+      case RunNumber:          return static_cast<int64_t>(event.run_number());
+      case Timestamp:          return static_cast<int64_t>(event.timestamp());
+      case TLBTap:             return decoded.tlb()[0];
+      case TLBTbp:             return decoded.tlb()[1];
+      case TLBInputBits:       return decoded.tlb()[2];
+      case BOBRMachineMode:    return decoded.bobr()[0];
+      case BOBRFillNumber:     return decoded.bobr()[1];
+      case BOBRBeam1Intensity: return decoded.bobr()[2];
+      case BOBRBeam2Intensity: return decoded.bobr()[3];
+      case TrackerHits: {
+	int64_t hits=0;
+	for(int64_t stationHits : decoded.stationHits()) hits+=stationHits;
+	return hits;
+      }
+      case TrackerStationHits: return decoded.stationHits()[index];
+      case DigiPeak:
+      case DigiMin:
+      case DigiMax:            return channelValue(variable, static_cast<int>(index), decoded.digitizer());
+      }
+      return 0;
+    }
+
+    static int64_t channelValue(Variable variable, int channel, const DigitizerView* digitizer) {
+      if (!digitizer || !digitizer->channel_has_data(channel)) return 0;
+      DigitizerData::ChannelView samples=digitizer->channel_adc_counts(channel);
+      if (samples.empty()) return 0;
+      int64_t min=samples[0];
+      int64_t max=samples[0];
+      for(uint16_t sample : samples) {
+	if (sample<min) min=sample;
+	if (sample>max) max=sample;
+      }
+      if (variable==DigiMin) return min;
+      if (variable==DigiMax) return max;
+      size_t nBaseline=std::min(samples.size(), static_cast<size_t>(BaselineSamples));
+      int64_t sum=0;
+      for(size_t ii=0; ii<nBaseline; ii++) sum+=samples[ii];
+      return (sum+static_cast<int64_t>(nBaseline/2))/static_cast<int64_t>(nBaseline)-min;
+    }
+
+    // Recursive descent parser, one function per precedence level
+
+    int addNode(Op op, int left=-1, int right=-1, int64_t value=0, Variable variable=EventTag) {
+      m_nodes.push_back(Node{op, value, variable, left, right});
+      return static_cast<int>(m_nodes.size()-1);
+    }
+
+    void skipSpace() {
+      while (m_pos<m_expression.size() && std::isspace(static_cast<unsigned char>(m_expression[m_pos]))) m_pos++;
+    }
+
+    /// Consume token if it comes next
+    bool accept(const char* token) {
+      skipSpace();
+      size_t len=strlen(token);
+      if (m_expression.compare(m_pos, len, token)!=0) return false;
+      // don't mistake || for | or && for &
+      if (len==1 && (token[0]=='|' || token[0]=='&') && m_pos+1<m_expression.size() && m_expression[m_pos+1]==token[0]) return false;
+      m_pos+=len;
+      return true;
+    }
+
+    void expect(const char* token) {
+      if (!accept(token)) syntaxError(std::string("expected '")+token+"'");
+    }
+
+    [[noreturn]] void syntaxError(const std::string& message) const {
+      THROW(ESelectionException,"Invalid selection \""+m_expression+"\" at position "+std::to_string(m_pos)+": "+message);
+    }
+
+    int parseOr() {
+      int node=parseAnd();
+      while (accept("||")) node=addNode(Or, node, parseAnd());
+      return node;
+    }
+
+    int parseAnd() {
+      int node=parseNot();
+      while (accept("&&")) node=addNode(And, node, parseNot());
+      return node;
+    }
+
+    int parseNot() {
+      if (accept("!") ) return addNode(Not, parseNot());
+      return parseComparison();
+    }
+
+    int parseComparison() {
+      static const std::pair<const char*, Op> ops[]={
+	{"==", Equal}, {"!=", NotEqual}, {"<=", LessEqual}, {">=", GreaterEqual}, {"<", Less}, {">", Greater}
+      };
+      int node=parseBitOr();
+      for(const auto& op : ops) {
+	if (accept(op.first)) return addNode(op.second, node, parseBitOr());
+      }
+      return node;
+    }
+
+    int parseBitOr() {
+      int node=parseBitAnd();
+      while (accept("|")) node=addNode(BitOr, node, parseBitAnd());
+      return node;
+    }
+
+    int parseBitAnd() {
+      int node=parsePrimary();
+      while (accept("&")) node=addNode(BitAnd, node, parsePrimary());
+      return node;
+    }
+
+    int parsePrimary() {
+      skipSpace();
+      if (accept("(")) {
+	int node=parseOr();
+	expect(")");
+	return node;
+      }
+      if (m_pos<m_expression.size() && std::isdigit(static_cast<unsigned char>(m_expression[m_pos]))) {
+	return addNode(Constant, -1, -1, parseNumber());
+      }
+      size_t start=m_pos;
+      while (m_pos<m_expression.size() &&
+	     (std::isalnum(static_cast<unsigned char>(m_expression[m_pos])) || m_expression[m_pos]=='_' || m_expression[m_pos]=='.')) m_pos++;
+      if (start==m_pos) syntaxError("expected quantity or number");
+      std::string name=m_expression.substr(start, m_pos-start);
+      bool indexed=accept("[");
+      int64_t index=0;
+      if (indexed) {
+	skipSpace();
+	index=parseNumber();
+	expect("]");
+      }
+      for(const auto& var : variables()) {
+	if (name!=var.name || indexed!=(var.indices>0)) continue;
+	if (indexed && (index<0 || index>=static_cast<int64_t>(var.indices)))
+	  syntaxError("index of "+name+" must be below "+std::to_string(var.indices));
+	m_used|=(1u<<var.detector);
+	return addNode(Load, -1, -1, index, var.variable);
+      }
+      m_pos=start;
+      syntaxError("unknown quantity '"+name+(indexed ? "[]'" : "'"));
+    }
+
+    int64_t parseNumber() {
+      const char* begin=m_expression.c_str()+m_pos;
+      char* end=nullptr;
+      long long value=std::strtoll(begin, &end, 0);
+      if (end==begin) syntaxError("expected number");
+      m_pos+=static_cast<size_t>(end-begin);
+      return value;
+    }
+
+    std::string m_expression;
+    size_t m_pos;
+    unsigned int m_used;
+    std::vector<Node> m_nodes;
+    int m_root;
+  };
+
+}
@@ -0,0 +1,177 @@
+/*
+  Copyright (C) 2019-2020 CERN for the benefit of the FASER collaboration
+*/
+
+///////////////////////////////////////////////////////////////////
+// EventView.hpp, (c) FASER Detector software
+///////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <iterator>
+#include "EventFormats/DAQFormats.hpp"
+
+namespace DAQFormats {
+
+  /** \brief Non-owning view of an encoded fragment
+   *
+   *  The fragment header is checked in place and the payload is never copied,
+   *  so the view is only valid as long as the underlying buffer is. The payload
+   *  can be handed directly to the detector decoders, e.g.
+   *  TLBDataFragment(view.payload<const uint32_t*>(), view.payload_size())
+   */
+  class FragmentView {
+  public:
+
+    /// Empty view, as returned when a fragment is not found
+    FragmentView() : m_header(nullptr) {}
+
+    /// View of an already encoded fragment
+    FragmentView(const uint8_t *data, size_t size, bool allowExcessData=false) :
+      m_header(checkFragmentHeader(data, size, allowExcessData)) {}
+
+    /// False for an empty view
+    explicit operator bool() const { return m_header!=nullptr; }
+
+    /// \brief Returns the payload as pointer of desired type
+    template <typename T = const void *> T payload() const {
+      static_assert(std::is_pointer<T>(), "Type parameter must be a pointer type");
+      return reinterpret_cast<T>(data()+m_header->header_size);
+    }
+
+    /// Start of encoded fragment, including the header
+    const uint8_t * data() const { return reinterpret_cast<const uint8_t *>(m_header); }
+
+    //getters here
+    uint64_t event_id() const { return m_header->event_id; }
+    uint8_t  fragment_tag() const { return m_header->fragment_tag; }
+    uint32_t source_id() const { return m_header->source_id; }
+    uint16_t bc_id() const { return m_header->bc_id; }
+    uint16_t status() const { return m_header->status; }
+    uint16_t trigger_bits() const { return m_header->trigger_bits; }
+    uint32_t size() const { return m_header->header_size+m_header->payload_size; }
+    uint16_t header_size() const { return m_header->header_size; }
+    uint32_t payload_size() const { return m_header->payload_size; }
+    uint64_t timestamp() const { return m_header->timestamp; }
+
+  private:
+    const EventFragmentHeader* m_header;
+  };
+
+  /** \brief Non-owning view of an encoded event
+   *
+   *  Only the event header is checked on construction. Fragment headers are
+   *  checked in place while iterating over the fragments, nothing is copied.
+   */
+  class EventView {
+  public:
+
+    /// Forward iterator over the fragments of the event
+    class const_iterator {
+    public:
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = FragmentView;
+      using difference_type = std::ptrdiff_t;
+      using pointer = const FragmentView*;
+      using reference = const FragmentView&;
+
+      const_iterator() : m_next(nullptr), m_left(0), m_count(0) {}
+      const_iterator(const uint8_t *data, size_t size, unsigned int count) :
+	m_next(data), m_left(size), m_count(count) {
+	if (m_count) m_current=FragmentView(m_next, m_left, true);
+      }
+
+      reference operator*() const { return m_current; }
+      pointer operator->() const { return &m_current; }
+
+      const_iterator& operator++() {
+	m_next+=m_current.size();
+	m_left-=m_current.size();
+	if (--m_count) m_current=FragmentView(m_next, m_left, true);
+	else m_current=FragmentView();
+	return *this;
+      }
+      const_iterator operator++(int) {
+	const_iterator old(*this);
+	++(*this);
+	return old;
+      }
+
+      bool operator==(const const_iterator& other) const {
+	return (m_count==other.m_count) && (!m_count || m_next==other.m_next);
+      }
+      bool operator!=(const const_iterator& other) const { return !(*this==other); }
+
+    private:
+      const uint8_t* m_next;
+      size_t m_left;
+      unsigned int m_count;
+      FragmentView m_current;
+    };
+
+    /// Empty view
+    EventView() : m_header(nullptr) {}
+
+    /** \brief View of an existing event in a stream of bytes
+     *
+     *  If allowExcessData is set, the buffer may extend beyond the end of the event
+     */
+    EventView(const uint8_t *data, size_t size, bool allowExcessData=false) :
+      m_header(checkEventHeader(data, size)) {
+      if (size<m_header->header_size) THROW(EFormatException,"Too small to be event");
+      if (size-m_header->header_size<m_header->payload_size)
+	THROW(EFormatException,"Event size does not match header information");
+      if ((size!=this->size()) && !allowExcessData)
+	THROW(EFormatException,"Payload size does not match header information");
+    }
+
+    /// False for an empty view
+    explicit operator bool() const { return m_header!=nullptr; }
+
+    /// Start of encoded event, including the header
+    const uint8_t * data() const { return reinterpret_cast<const uint8_t *>(m_header); }
+
+    /// Start of the fragment data
+    const uint8_t * payload() const { return data()+m_header->header_size; }
+
+    /// Encoded event header
+    const EventHeader& event_header() const { return *m_header; }
+
+    // getters here
+    uint8_t event_tag() const { return m_header->event_tag; }
+    uint8_t status() const { return static_cast<uint8_t>(m_header->status); }
+    uint64_t event_id() const { return m_header->event_id; }
+    uint64_t event_counter() const { return m_header->event_counter; }
+    uint16_t bc_id() const { return m_header->bc_id; }
+    uint32_t size() const { return m_header->header_size+m_header->payload_size; }
+    uint16_t header_size() const { return m_header->header_size; }
+    uint32_t payload_size() const { return m_header->payload_size; }
+    uint64_t timestamp() const { return m_header->timestamp; }
+    uint64_t run_number() const { return m_header->run_number; }
+    uint16_t trigger_bits() const { return m_header->trigger_bits; }
+    uint16_t fragment_count() const { return m_header->fragment_count; }
+
+    const_iterator begin() const { return const_iterator(payload(), payload_size(), fragment_count()); }
+    const_iterator end() const { return const_iterator(); }
+
+    /// Find fragment with specific source id, returns an empty view if not present
+    FragmentView find_fragment(uint32_t source_id) const {
+      for(const auto& frag : *this) {
+	if (frag.source_id()==source_id) return frag;
+      }
+      return FragmentView();
+    }
+
+  private:
+    const EventHeader* m_header;
+  };
+
+}
+
+inline std::ostream &operator<<(std::ostream &out, const  DAQFormats::FragmentView &frag) {
+  return DAQFormats::printFragmentHeader(out, frag);
+}
+
+inline std::ostream &operator<<(std::ostream &out, const  DAQFormats::EventView &ev) {
+  return DAQFormats::printEventHeader(out, ev);
+}
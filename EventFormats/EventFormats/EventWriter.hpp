@@ -0,0 +1,222 @@
+/*
+  Copyright (C) 2019-2020 CERN for the benefit of the FASER collaboration
+*/
+
+///////////////////////////////////////////////////////////////////
+// EventWriter.hpp, (c) FASER Detector software
+///////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <string>
+#include <memory>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "EventFormats/DAQFormats.hpp"
+#include "EventFormats/EventView.hpp"
+#include "EventFormats/EventIndex.hpp"
+
+namespace DAQFormats {
+
+  /// Settings for EventWriter
+  struct EventWriterOptions {
+    size_t   block_size = 4*1024*1024; ///< bytes collected before writing, multiple of 4096
+    bool     direct_io = false;        ///< bypass page cache with O_DIRECT where supported
+    bool     append = false;           ///< append to existing file(s) instead of overwriting
+    uint64_t max_file_size = 0;        ///< start new file before exceeding this size, 0 for no limit
+    uint64_t max_events = 0;           ///< start new file after this number of events, 0 for no limit
+    bool     write_index = false;      ///< write sidecar index for each file as events are written
+  };
+
+  /** \brief Buffered writer for raw data files
+   *
+   *  Events are collected in large aligned blocks which are written with a
+   *  single system call each. If a size or event limit is set, output rotates
+   *  to a new file when the limit is reached, and files are then named
+   *  <stem>-NNNNN<extension> after the given file name, e.g. out-00000.raw.
+   *
+   *  close() has to be called to write out the last block. The destructor also
+   *  does this, but can not report errors.
+   */
+  class EventWriter {
+  public:
+    explicit EventWriter(const std::string& filename, const EventWriterOptions& options=EventWriterOptions()) :
+      m_filename(filename), m_options(options), m_block(nullptr, &free), m_used(0),
+      m_fd(-1), m_direct(false), m_fileNumber(0), m_fileSize(0), m_fileEvents(0),
+      m_totalEvents(0), m_totalBytes(0) {
+      if (m_options.block_size<Alignment || m_options.block_size%Alignment)
+	THROW(EFormatException,"Block size must be a multiple of "+std::to_string(Alignment));
+      void* block=nullptr;
+      if (posix_memalign(&block, Alignment, m_options.block_size))
+	THROW(EFormatException,"Failed to allocate output block");
+      m_block.reset(static_cast<uint8_t*>(block));
+      openFile();
+    }
+
+    ~EventWriter() {
+      try {
+	close();
+      } catch (EFormatException &) {
+	// nothing can be done here, call close() explicitly to see errors
+      }
+    }
+
+    // prohibit copy and assign
+    EventWriter(const EventWriter& other) = delete;
+    EventWriter& operator=(const EventWriter& other) = delete;
+
+    /// Write encoded event, e.g. from an EventFileReader
+    void write(const EventView& event) {
+      startEvent(event.size());
+      if (m_index) m_index->add(makeIndexEntry(event, m_fileSize));
+      append(event.data(), event.size());
+      endEvent(event.size());
+    }
+
+    /// Write event, copying its pieces straight into the output block
+    void write(const EventFull& event) {
+      size_t size=event.encoded_size();
+      startEvent(size);
+      if (m_index) m_index->add(makeIndexEntry(event.event_header(), m_fileSize, static_cast<uint32_t>(size)));
+      event.forEachPiece([this](const uint8_t *data, size_t len) { append(data, len); });
+      endEvent(size);
+    }
+
+    /// Write out all complete blocks. In direct I/O mode a partial block is kept until close()
+    void flush() {
+      if (!m_direct) {
+	writeBlock(m_used);
+	return;
+      }
+      size_t aligned=m_used-m_used%Alignment;
+      writeBlock(aligned);
+    }
+
+    /// Write out remaining data and close current file
+    void close() {
+      if (m_fd<0) return;
+      if (m_direct && m_used) {
+	// the tail is not a multiple of the alignment, so write it without O_DIRECT
+	flush();
+	int flags=fcntl(m_fd, F_GETFL);
+	if (flags>=0) fcntl(m_fd, F_SETFL, flags&~O_DIRECT);
+	m_direct=false;
+      }
+      flush();
+      int fd=m_fd;
+      m_fd=-1;
+      if (::close(fd)) THROW(EFormatException,"Failed to close "+m_currentName);
+      if (m_index) {
+	m_index->close(m_fileSize);
+	m_index.reset();
+      }
+    }
+
+    /// Name of the file currently written to
+    const std::string& current_filename() const { return m_currentName; }
+
+    /// Number of the current file, counting from 0
+    unsigned int file_number() const { return m_fileNumber; }
+
+    uint64_t events_written() const { return m_totalEvents; }
+    uint64_t bytes_written() const { return m_totalBytes; }
+
+  private:
+    static const size_t Alignment = 4096;
+
+    bool rotating() const { return m_options.max_file_size || m_options.max_events; }
+
+    std::string fileName() const {
+      if (!rotating()) return m_filename;
+      std::string number=std::to_string(m_fileNumber);
+      number=std::string(number.size()<5 ? 5-number.size() : 0, '0')+number;
+      size_t slash=m_filename.rfind('/');
+      size_t dot=m_filename.rfind('.');
+      if (dot==std::string::npos || (slash!=std::string::npos && dot<slash)) return m_filename+"-"+number;
+      return m_filename.substr(0, dot)+"-"+number+m_filename.substr(dot);
+    }
+
+    void openFile() {
+      m_currentName=fileName();
+      int flags=O_WRONLY | O_CREAT | (m_options.append ? O_APPEND : O_TRUNC);
+      m_direct=false;
+      m_fd=-1;
+      if (m_options.direct_io) {
+	struct stat st;
+	bool aligned=!m_options.append || stat(m_currentName.c_str(), &st)!=0 ||
+	  static_cast<size_t>(st.st_size)%Alignment==0;
+	if (aligned) {
+	  m_fd=open(m_currentName.c_str(), flags | O_DIRECT, 0644);
+	  m_direct=(m_fd>=0);
+	}
+      }
+      if (m_fd<0) m_fd=open(m_currentName.c_str(), flags, 0644); // also fallback if O_DIRECT is not supported
+      if (m_fd<0) THROW(EFormatException,"Can't open output file "+m_currentName);
+      m_fileSize=0;
+      if (m_options.append) {
+	struct stat st;
+	if (fstat(m_fd, &st)==0) m_fileSize=static_cast<uint64_t>(st.st_size);
+      }
+      m_fileEvents=0;
+      if (m_options.write_index) {
+	if (m_fileSize) THROW(EFormatException,"Can't write index when appending to "+m_currentName);
+	m_index.reset(new EventIndexWriter(indexFileName(m_currentName)));
+      }
+    }
+
+    void startEvent(size_t size) {
+      bool full=(m_options.max_events && m_fileEvents>=m_options.max_events) ||
+	(m_options.max_file_size && m_fileEvents && m_fileSize+size>m_options.max_file_size);
+      if (!full) return;
+      close();
+      m_fileNumber++;
+      openFile();
+    }
+
+    void endEvent(size_t size) {
+      m_fileSize+=size;
+      m_fileEvents++;
+      m_totalEvents++;
+      m_totalBytes+=size;
+    }
+
+    void append(const uint8_t *data, size_t size) {
+      while (size) {
+	size_t chunk=std::min(size, m_options.block_size-m_used);
+	memcpy(m_block.get()+m_used, data, chunk);
+	m_used+=chunk;
+	data+=chunk;
+	size-=chunk;
+	if (m_used==m_options.block_size) writeBlock(m_used);
+      }
+    }
+
+    /// Write first size bytes of the block and move the rest to the front
+    void writeBlock(size_t size) {
+      if (!size) return;
+      struct iovec iov={m_block.get(), size};
+      writeAll(m_fd, &iov, 1);
+      m_used-=size;
+      if (m_used) memmove(m_block.get(), m_block.get()+size, m_used);
+    }
+
+    std::string m_filename;
+    std::string m_currentName;
+    EventWriterOptions m_options;
+    std::unique_ptr<uint8_t, void(*)(void*)> m_block;
+    size_t m_used;
+    int m_fd;
+    bool m_direct;
+    unsigned int m_fileNumber;
+    uint64_t m_fileSize;
+    uint64_t m_fileEvents;
+    uint64_t m_totalEvents;
+    uint64_t m_totalBytes;
+    std::unique_ptr<EventIndexWriter> m_index;
+  };
+
+}
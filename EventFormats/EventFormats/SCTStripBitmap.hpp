@@ -0,0 +1,128 @@
+/*
+  Copyright (C) 2019-2020 CERN for the benefit of the FASER collaboration
+*/
+
+///////////////////////////////////////////////////////////////////
+// SCTStripBitmap.hpp, (c) FASER Detector software
+///////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "EventFormats/TrackerDataFragment.hpp"
+
+/** \brief Strips with hits of one SCT module, one bit per strip
+ *
+ *  Strips are numbered per side from 0 to 767 as chip on the side times 128
+ *  plus the strip on the chip, with chips 0-5 of SCTEvent on side 0 and
+ *  chips 6-11 on side 1. Hits that fail the hit pattern filter or have a
+ *  strip number beyond the chip are left out. Clusters are runs of adjacent
+ *  strips, found with bit scans over 64 strips at a time.
+ */
+class SCTStripBitmap
+{
+  public:
+    static const size_t STRIPS = TrackerDataFragment::STRIPS_PER_SIDE;
+    static const size_t SIDES = TrackerDataFragment::SIDES_PER_MODULE;
+    static const size_t WORDS = STRIPS / 64;
+    static_assert(STRIPS % 64 == 0, "Strips per side must fill whole 64-bit words");
+
+    /// Filter accepting every hit pattern
+    static const uint8_t ANY_PATTERN = 0xFF;
+
+    struct Cluster {
+      uint16_t first_strip;
+      uint16_t width;
+      uint8_t side;
+    };
+
+    /** \brief Filter for fill() from a pattern like "X1X"
+     *
+     *  The three characters give the time bins from most to least significant
+     *  bit as '0', '1' or 'X' for either. The result has bit p set for each
+     *  accepted hit pattern p.
+     */
+    static constexpr uint8_t pattern_filter(const char* spec) {
+      uint8_t filter = 0;
+      for (unsigned int pattern = 0; pattern < 8; pattern++) {
+        bool accept = true;
+        for (unsigned int bin = 0; bin < 3; bin++) {
+          bool set = (pattern >> (2 - bin)) & 1;
+          if ((spec[bin] == '1' && !set) || (spec[bin] == '0' && set)) accept = false;
+        }
+        if (accept) filter = static_cast<uint8_t>(filter | (1u << pattern));
+      }
+      return filter;
+    }
+
+    SCTStripBitmap() { clear(); }
+    explicit SCTStripBitmap(const SCTEvent& sct, uint8_t filter = ANY_PATTERN) { fill(sct, filter); }
+
+    void clear() {
+      for (auto& side : m_bits) side.fill(0);
+    }
+
+    /// Replace content by the hits of sct that pass the filter
+    void fill(const SCTEvent& sct, uint8_t filter = ANY_PATTERN) {
+      clear();
+      size_t chip = 0;
+      for (auto hits : sct.GetHits()) {
+        size_t side = chip / TrackerDataFragment::CHIPS_PER_SIDE;
+        size_t offset = (chip % TrackerDataFragment::CHIPS_PER_SIDE) * TrackerDataFragment::STRIPS_PER_CHIP;
+        const uint8_t* strips = hits.strips();
+        const uint8_t* patterns = hits.patterns();
+        for (size_t hit = 0; hit < hits.size(); hit++) {
+          if (strips[hit] >= TrackerDataFragment::STRIPS_PER_CHIP || !((filter >> (patterns[hit] & 0x7)) & 1)) continue;
+          set(side, offset + strips[hit]);
+        }
+        chip++;
+      }
+    }
+
+    void set(size_t side, size_t strip) { m_bits[side][strip / 64] |= uint64_t(1) << (strip % 64); }
+    bool test(size_t side, size_t strip) const { return (m_bits[side][strip / 64] >> (strip % 64)) & 1; }
+    const std::array<uint64_t, WORDS>& bits(size_t side) const { return m_bits[side]; }
+
+    /// Number of strips with hits on one side
+    size_t occupancy(size_t side) const {
+      size_t count = 0;
+      for (uint64_t word : m_bits[side]) count += static_cast<size_t>(__builtin_popcountll(word));
+      return count;
+    }
+    size_t occupancy() const { return occupancy(0) + occupancy(1); }
+
+    /// Call function(const Cluster&) for each cluster, side 0 first, in increasing strip order
+    template <typename Function> void forEachCluster(Function function) const {
+      for (size_t side = 0; side < SIDES; side++) {
+        size_t strip = nextStrip(side, 0, false);
+        while (strip < STRIPS) {
+          size_t end = nextStrip(side, strip, true);
+          function(Cluster{static_cast<uint16_t>(strip), static_cast<uint16_t>(end - strip), static_cast<uint8_t>(side)});
+          strip = end < STRIPS ? nextStrip(side, end, false) : STRIPS;
+        }
+      }
+    }
+
+    /// Append all clusters to the vector, returns their number
+    size_t clusters(std::vector<Cluster>& result) const {
+      size_t before = result.size();
+      forEachCluster([&result](const Cluster& cluster) { result.push_back(cluster); });
+      return result.size() - before;
+    }
+
+  private:
+    /// First strip from strip on that has a hit (or none if empty is set), STRIPS if there is none
+    size_t nextStrip(size_t side, size_t strip, bool empty) const {
+      size_t word = strip / 64;
+      uint64_t bits = (empty ? ~m_bits[side][word] : m_bits[side][word]) & (~uint64_t(0) << (strip % 64));
+      while (!bits) {
+        if (++word == WORDS) return STRIPS;
+        bits = empty ? ~m_bits[side][word] : m_bits[side][word];
+      }
+      return word * 64 + static_cast<size_t>(__builtin_ctzll(bits));
+    }
+
+    std::array<std::array<uint64_t, WORDS>, SIDES> m_bits;
+};
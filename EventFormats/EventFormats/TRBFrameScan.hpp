@@ -0,0 +1,103 @@
+/*
+  Copyright (C) 2019-2020 CERN for the benefit of the FASER collaboration
+*/
+
+///////////////////////////////////////////////////////////////////
+// TRBFrameScan.hpp, (c) FASER Detector software
+///////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "EventFormats/CpuFeatures.hpp"
+
+/** \brief First sweep over the words of a TRB fragment
+ *
+ *  Finds the first word that breaks the frame counter sequence (bits 27-29
+ *  counting up modulo 8 from word to word, the end-of-DAQ word excepted) and
+ *  collects the positions of all TRB header, data and trailer words before
+ *  it. Everything else is module data, which is most of the fragment, so the
+ *  word-by-word decoding only has to look at the few TRB words. The sweep
+ *  uses AVX2 or SSE2 on x86-64 and plain C++ elsewhere.
+ */
+struct TRBFrameScan
+{
+  static const uint32_t MASK_MODULEDATA = 0x80000000; // set for LED and LEDX module data words
+  static const uint32_t RSHIFT_FRAMECNT = 27;
+  static const uint32_t FRAMECNT_CYCLE_MASK = 0x7;
+  static const uint32_t TRB_END = 0x07000eee;
+
+  size_t first_bad_frame {0};    ///< index of first word with wrong frame counter, or number of words
+  std::vector<uint32_t> trb_words; ///< indices of words that are not module data, before first_bad_frame
+
+  void scan(const uint32_t* data, size_t nWords) {
+    trb_words.clear();
+#ifdef EVENTFORMATS_X86_SIMD
+    if (CpuFeatures::avx2()) first_bad_frame = scanAVX2(data, nWords, trb_words);
+    else first_bad_frame = scanSSE2(data, nWords, trb_words);
+#else
+    first_bad_frame = scanScalar(data, 0, nWords, trb_words);
+#endif
+  }
+
+  /// Scan words from begin on, returns index of first bad frame counter or nWords
+  static size_t scanScalar(const uint32_t* data, size_t begin, size_t nWords, std::vector<uint32_t>& trbWords) {
+    for (size_t i = begin; i < nWords; i++) {
+      if (i > 0 && data[i] != TRB_END && (((data[i] >> RSHIFT_FRAMECNT) - (data[i-1] >> RSHIFT_FRAMECNT)) & FRAMECNT_CYCLE_MASK) != 1) return i;
+      if (!(data[i] & MASK_MODULEDATA)) trbWords.push_back(static_cast<uint32_t>(i));
+    }
+    return nWords;
+  }
+
+#ifdef EVENTFORMATS_X86_SIMD
+  static size_t scanSSE2(const uint32_t* data, size_t nWords, std::vector<uint32_t>& trbWords) {
+    size_t i = scanScalar(data, 0, nWords < 1 ? nWords : 1, trbWords);
+    if (i < 1) return i;
+    const __m128i cycle = _mm_set1_epi32(FRAMECNT_CYCLE_MASK);
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i end = _mm_set1_epi32(TRB_END);
+    for (; i + 4 <= nWords; i += 4) {
+      __m128i cur = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+      __m128i prev = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i - 1));
+      __m128i step = _mm_and_si128(_mm_sub_epi32(_mm_srli_epi32(cur, RSHIFT_FRAMECNT), _mm_srli_epi32(prev, RSHIFT_FRAMECNT)), cycle);
+      __m128i good = _mm_or_si128(_mm_cmpeq_epi32(step, one), _mm_cmpeq_epi32(cur, end));
+      unsigned int bad = ~static_cast<unsigned int>(_mm_movemask_ps(_mm_castsi128_ps(good))) & 0xFu;
+      unsigned int trb = ~static_cast<unsigned int>(_mm_movemask_ps(_mm_castsi128_ps(cur))) & 0xFu;
+      if (addWords(i, bad, trb, trbWords)) return i + static_cast<size_t>(__builtin_ctz(bad));
+    }
+    return scanScalar(data, i, nWords, trbWords);
+  }
+
+  __attribute__((target("avx2")))
+  static size_t scanAVX2(const uint32_t* data, size_t nWords, std::vector<uint32_t>& trbWords) {
+    size_t i = scanScalar(data, 0, nWords < 1 ? nWords : 1, trbWords);
+    if (i < 1) return i;
+    const __m256i cycle = _mm256_set1_epi32(FRAMECNT_CYCLE_MASK);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i end = _mm256_set1_epi32(TRB_END);
+    for (; i + 8 <= nWords; i += 8) {
+      __m256i cur = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+      __m256i prev = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i - 1));
+      __m256i step = _mm256_and_si256(_mm256_sub_epi32(_mm256_srli_epi32(cur, RSHIFT_FRAMECNT), _mm256_srli_epi32(prev, RSHIFT_FRAMECNT)), cycle);
+      __m256i good = _mm256_or_si256(_mm256_cmpeq_epi32(step, one), _mm256_cmpeq_epi32(cur, end));
+      unsigned int bad = ~static_cast<unsigned int>(_mm256_movemask_ps(_mm256_castsi256_ps(good))) & 0xFFu;
+      unsigned int trb = ~static_cast<unsigned int>(_mm256_movemask_ps(_mm256_castsi256_ps(cur))) & 0xFFu;
+      if (addWords(i, bad, trb, trbWords)) return i + static_cast<size_t>(__builtin_ctz(bad));
+    }
+    return scanScalar(data, i, nWords, trbWords);
+  }
+
+private:
+  /// Record TRB words of a block starting at index base, up to the first bad lane. Returns true if there was one
+  static bool addWords(size_t base, unsigned int bad, unsigned int trb, std::vector<uint32_t>& trbWords) {
+    if (bad) trb &= (1u << __builtin_ctz(bad)) - 1;
+    while (trb) {
+      trbWords.push_back(static_cast<uint32_t>(base + static_cast<size_t>(__builtin_ctz(trb))));
+      trb &= trb - 1;
+    }
+    return bad != 0;
+  }
+#endif
+};
@@ -0,0 +1,115 @@
+/*
+  Copyright (C) 2019-2020 CERN for the benefit of the FASER collaboration
+*/
+
+///////////////////////////////////////////////////////////////////
+// TaskPool.hpp, (c) FASER Detector software
+///////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace DAQFormats {
+
+  /** \brief Small fixed set of threads for running a loop in parallel
+   *
+   *  run(n, function) calls function(i) for every i in [0,n), spread over the
+   *  pool threads and the calling thread, and returns once all calls are
+   *  done. The first exception thrown by a call is rethrown by run(). Only one
+   *  thread at a time may call run() on the same pool.
+   */
+  class TaskPool {
+  public:
+    /// Pool with nThreads threads in addition to the one calling run()
+    explicit TaskPool(size_t nThreads) : m_call(nullptr), m_context(nullptr), m_size(0), m_next(0),
+					 m_active(0), m_generation(0), m_stop(false) {
+      for(size_t ii=0; ii<nThreads; ii++) m_threads.emplace_back(&TaskPool::work, this);
+    }
+
+    ~TaskPool() {
+      {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_stop=true;
+      }
+      m_wake.notify_all();
+      for(auto& thread : m_threads) thread.join();
+    }
+
+    // prohibit copy and assign
+    TaskPool(const TaskPool& other) = delete;
+    TaskPool& operator=(const TaskPool& other) = delete;
+
+    size_t threads() const { return m_threads.size(); }
+
+    template <typename Function> void run(size_t n, Function&& function) {
+      if (!n) return;
+      {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_call=[](void* context, size_t index) { (*static_cast<typename std::remove_reference<Function>::type*>(context))(index); };
+	m_context=const_cast<void*>(static_cast<const void*>(&function));
+	m_size=n;
+	m_next=0;
+	m_error=nullptr;
+	m_active=m_threads.size();
+	m_generation++;
+      }
+      m_wake.notify_all();
+      process();
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_done.wait(lock, [this] { return m_active==0; });
+      if (m_error) std::rethrow_exception(m_error);
+    }
+
+  private:
+    void work() {
+      uint64_t seen=0;
+      while(true) {
+	{
+	  std::unique_lock<std::mutex> lock(m_mutex);
+	  m_wake.wait(lock, [this, seen] { return m_stop || m_generation!=seen; });
+	  if (m_stop) return;
+	  seen=m_generation;
+	}
+	process();
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (--m_active==0) m_done.notify_one();
+      }
+    }
+
+    /// Take indices until all are handed out
+    void process() {
+      while(true) {
+	size_t index=m_next++;
+	if (index>=m_size) return;
+	try {
+	  m_call(m_context, index);
+	} catch (...) {
+	  std::lock_guard<std::mutex> lock(m_mutex);
+	  if (!m_error) m_error=std::current_exception();
+	}
+      }
+    }
+
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    void (*m_call)(void*, size_t);
+    void* m_context;
+    size_t m_size;
+    std::atomic<size_t> m_next;
+    size_t m_active;
+    uint64_t m_generation;
+    bool m_stop;
+    std::exception_ptr m_error;
+  };
+
+}
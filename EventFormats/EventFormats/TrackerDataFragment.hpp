@@ -11,6 +11,8 @@
 #include "Exceptions/Exceptions.hpp"
 #include "Logging.hpp"
 #include "EventFormats/FletcherChecksum.hpp"
+#include "EventFormats/TRBFrameScan.hpp"
+#include "EventFormats/TaskPool.hpp"
 #include <iomanip>
 #include <map>
 #include <chrono>
@@ -19,29 +21,134 @@
 #include <string>
 #include <cstdint>
 #include <vector>
+#include <array>
+#include <algorithm>
+#include <iterator>
 #include <memory>
+#include <sstream>
 
 
 CREATE_EXCEPTION_TYPE(TrackerDataException,TrackerData)
+
+/** \brief Decoded data of one SCT module
+ *
+ *  Hits of all chips are kept in one array, grouped by chip, with the strip
+ *  numbers and hit patterns stored separately. Errors are kept inside the
+ *  object. GetHits()/GetErrors() return light-weight views that can be
+ *  iterated like the per-chip vectors used before.
+ */
 struct SCTEvent 
 {
 public:
+    static const size_t CHIPS = 12;
+    static const size_t MAX_ERRORS = 64; // further errors are not stored, but still flagged by HasError()
+
+    /// Hit as (strip on chip, hit pattern)
+    using Hit = std::pair<uint8_t, uint8_t>;
+
+    /// Hits of one chip
+    class HitRange {
+    public:
+        class const_iterator {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = Hit;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const Hit*;
+            using reference = Hit;
+            const_iterator(const uint8_t* strip, const uint8_t* pattern) : m_strip(strip), m_pattern(pattern) {}
+            Hit operator*() const { return Hit(*m_strip, *m_pattern); }
+            const_iterator& operator++() { ++m_strip; ++m_pattern; return *this; }
+            bool operator==(const const_iterator& other) const { return m_strip == other.m_strip; }
+            bool operator!=(const const_iterator& other) const { return m_strip != other.m_strip; }
+        private:
+            const uint8_t* m_strip;
+            const uint8_t* m_pattern;
+        };
+        HitRange(const SCTEvent& sct, size_t index) :
+          m_strips(sct.m_strips.data() + sct.m_hitOffsets[index]), m_patterns(sct.m_patterns.data() + sct.m_hitOffsets[index]),
+          m_size(static_cast<size_t>(sct.m_hitOffsets[index+1] - sct.m_hitOffsets[index])) {}
+        const_iterator begin() const { return const_iterator(m_strips, m_patterns); }
+        const_iterator end() const { return const_iterator(m_strips + m_size, m_patterns + m_size); }
+        size_t size() const { return m_size; }
+        bool empty() const { return m_size == 0; }
+        Hit operator[](size_t hit) const { return Hit(m_strips[hit], m_patterns[hit]); }
+        const uint8_t* strips() const { return m_strips; }
+        const uint8_t* patterns() const { return m_patterns; }
+    private:
+        const uint8_t* m_strips;
+        const uint8_t* m_patterns;
+        size_t m_size;
+    };
+
+    /// Errors of one chip
+    class ErrorRange {
+    public:
+        using const_iterator = const uint8_t*;
+        ErrorRange(const SCTEvent& sct, size_t index) :
+          m_begin(sct.m_errors.data() + sct.m_errorOffsets[index]), m_end(sct.m_errors.data() + sct.m_errorOffsets[index+1]) {}
+        const_iterator begin() const { return m_begin; }
+        const_iterator end() const { return m_end; }
+        size_t size() const { return static_cast<size_t>(m_end - m_begin); }
+        bool empty() const { return m_begin == m_end; }
+        uint8_t operator[](size_t error) const { return m_begin[error]; }
+    private:
+        const uint8_t* m_begin;
+        const uint8_t* m_end;
+    };
+
+    /// HitRange or ErrorRange for each chip of the module
+    template <typename Range> class ChipRanges {
+    public:
+        class const_iterator {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = Range;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const Range*;
+            using reference = Range;
+            const_iterator(const SCTEvent& sct, size_t index) : m_sct(&sct), m_index(index) {}
+            Range operator*() const { return Range(*m_sct, m_index); }
+            const_iterator& operator++() { ++m_index; return *this; }
+            bool operator==(const const_iterator& other) const { return m_index == other.m_index; }
+            bool operator!=(const const_iterator& other) const { return m_index != other.m_index; }
+        private:
+            const SCTEvent* m_sct;
+            size_t m_index;
+        };
+        explicit ChipRanges(const SCTEvent& sct) : m_sct(sct) {}
+        const_iterator begin() const { return const_iterator(m_sct, 0); }
+        const_iterator end() const { return const_iterator(m_sct, CHIPS); }
+        size_t size() const { return CHIPS; }
+        Range operator[](size_t index) const { return Range(m_sct, index); }
+    private:
+        const SCTEvent& m_sct;
+    };
+
+    SCTEvent () : SCTEvent(0, 0, 0) {}
     SCTEvent (uint8_t module, unsigned int l1id, unsigned int bcid);
-    ~SCTEvent() {}
-    
+
+    /// Start over for a new module header, keeping the allocated memory
+    void Reset(uint8_t module, unsigned int l1id, unsigned int bcid);
     void AddHeader(unsigned int l1id, unsigned int bcid);
     void AddHit (unsigned int chip, unsigned int strip, unsigned int pattern);
+    /// Add n hits on consecutive strips starting at firstStrip
+    void AddHits (unsigned int chip, unsigned int firstStrip, const uint8_t* patterns, size_t n);
     void AddError (unsigned int chip, unsigned int err);
-    void AddUnknownChip (unsigned int chip) {m_UnkownChips.push_back(chip);}
+    void AddUnknownChip (unsigned int chip) {m_UnkownChips.push_back(static_cast<uint8_t>(chip));}
+
+    /// Position of chip (full chip ID, i.e. 0x20-0x25 and 0x28-0x2d) in the module, or -1 if unknown
+    static constexpr int ChipIndex(unsigned int chipID) {
+      return ((chipID & ~0xFu) == 0x20) ? CHIP_INDEX[chipID & 0xF] : -1;
+    }
     
     unsigned short                                              GetModuleID() const { return m_moduleID; }
     unsigned int GetNHits() const;
     unsigned int GetNHits(size_t chip) const;
-    const std::vector < std::vector < std::pair<uint8_t, uint8_t> > >& 
-                                                                GetHits() const {return m_Hits;}
-    const std::vector < std::pair<uint8_t, uint8_t> >&          GetHits(size_t chip) const;
-    const std::vector < std::vector < uint8_t > >&              GetErrors() const {return m_Errors;}
-    const std::vector < uint8_t >&                              GetErrors(size_t chip) const;
+    ChipRanges<HitRange>                                        GetHits() const {return ChipRanges<HitRange>(*this);}
+    HitRange                                                    GetHits(size_t chip) const;
+    ChipRanges<ErrorRange>                                      GetErrors() const {return ChipRanges<ErrorRange>(*this);}
+    ErrorRange                                                  GetErrors(size_t chip) const;
     const std::vector < uint8_t >&                              GetUnknownChips() const {return m_UnkownChips;}
     
     bool HasError() const {return m_hasError;}
@@ -55,8 +162,7 @@ public:
     bool ChipIsValid(unsigned int chip) {
           m_chipIsValid=true;
           chip |= 0x20; // adding 2 MSB for chip address. All chips are served by "primary fiber".
-          auto it = m_chipIDMap.find(chip);
-          if (it == m_chipIDMap.end()) {
+          if (ChipIndex(chip) < 0) {
             std::stringstream s;
             s << std::hex << chip;
             m_complete = false;
@@ -71,8 +177,13 @@ public:
     unsigned short GetBCID() const {return m_bcid;}
     
 private:
-    std::vector < std::vector < std::pair<uint8_t, uint8_t> > > m_Hits; // chips[12][nHits] , hit = pair {Strip Nr, Hit pattern}
-    std::vector < std::vector < uint8_t > > m_Errors; // chips[12][error]
+    static constexpr int8_t CHIP_INDEX[16] = { 0, 1, 2, 3, 4, 5, -1, -1, 6, 7, 8, 9, 10, 11, -1, -1 };
+
+    std::vector < uint8_t > m_strips; // strip numbers of all hits, grouped by chip
+    std::vector < uint8_t > m_patterns; // hit patterns, same order as m_strips
+    std::array < uint32_t, CHIPS+1 > m_hitOffsets; // hits of chip i are [m_hitOffsets[i], m_hitOffsets[i+1]), corrupt streams can give any number of hits
+    std::array < uint8_t, MAX_ERRORS > m_errors; // error codes, grouped by chip
+    std::array < uint8_t, CHIPS+1 > m_errorOffsets;
     std::vector < uint8_t > m_UnkownChips; // chipIDs that were not expected
     unsigned short m_moduleID;
     unsigned short m_bcid;
@@ -83,7 +194,6 @@ private:
     bool m_bcidMismatch; // bcid mismatch between led and ledX data streams
     bool m_hasError; // bcid mismatch between led and ledX data streams
     bool m_chipIsValid=true; //check if chip exists in map
-    std::map<unsigned int, unsigned int> m_chipIDMap; // maps chipID to vector index
 };
 
 struct TrackerDataFragment
@@ -133,20 +243,20 @@ struct TrackerDataFragment
     const unsigned int usefulBitsModuleData = 32 ; // How many bits are used per word? All MASK / TAG constants rely on this alignment
     // MASKS for module data
     
-    const uint32_t MASK_MODULE_HEADER = 0xFC002000;
-    const uint32_t TAG_MODULE_HEADER  = 0xE8002000;
-    const uint32_t MASK_MODULE_TRAILER= 0xFFFF0000;
-    const uint32_t TAG_MODULE_TRAILER = 0x80000000;
-    const uint32_t MASK_MODULE_ERROR  = 0xE0200000;
-    const uint32_t TAG_MODULE_ERROR   = 0x00200000;
-    const uint32_t MASK_MODULE_CONFIG = 0xE1C02010;
-    const uint32_t TAG_MODULE_CONFIG  = 0x1C02010;
+    static const uint32_t MASK_MODULE_HEADER = 0xFC002000;
+    static const uint32_t TAG_MODULE_HEADER  = 0xE8002000;
+    static const uint32_t MASK_MODULE_TRAILER= 0xFFFF0000;
+    static const uint32_t TAG_MODULE_TRAILER = 0x80000000;
+    static const uint32_t MASK_MODULE_ERROR  = 0xE0200000;
+    static const uint32_t TAG_MODULE_ERROR   = 0x00200000;
+    static const uint32_t MASK_MODULE_CONFIG = 0xE1C02010;
+    static const uint32_t TAG_MODULE_CONFIG  = 0x1C02010;
   //    const uint32_t MASK_MODULE_DATA   = 0xC0040000;
   //    const uint32_t TAG_MODULE_DATA    = 0x40040000;
-    const uint32_t MASK_MODULE_DATA   = 0xC0000000; //don't look for first hit bit here as might be missing in buggy module 0
-    const uint32_t TAG_MODULE_DATA    = 0x40000000;
-    const uint32_t MASK_MODULE_NODATA = 0xE0000000;
-    const uint32_t TAG_MODULE_NODATA  = 0x20000000;
+    static const uint32_t MASK_MODULE_DATA   = 0xC0000000; //don't look for first hit bit here as might be missing in buggy module 0
+    static const uint32_t TAG_MODULE_DATA    = 0x40000000;
+    static const uint32_t MASK_MODULE_NODATA = 0xE0000000;
+    static const uint32_t TAG_MODULE_NODATA  = 0x20000000;
     
     // access data modules with bit shift & mask
     const uint32_t RSHIFT_MODULE_BCID = 14;
@@ -177,9 +287,23 @@ struct TrackerDataFragment
     static const uint32_t STRIPS_PER_CHIP = 128;
     static const uint32_t STRIPS_PER_SIDE = STRIPS_PER_CHIP * CHIPS_PER_SIDE;
  
-    TrackerDataFragment( const uint32_t *data, size_t size );
-
-    void DecodeModuleData(std::map< std::pair<uint8_t, uint8_t>, std::vector<uint32_t> > dataMap);
+    /** \brief How much work the constructor does
+     *
+     *  With DecodeAll the checksum and all modules are computed right away.
+     *  With DecodeOnDemand the constructor only splits the words by module,
+     *  each module is decoded the first time it is accessed through hasData(),
+     *  operator[] or iteration, and the checksum when it is checked. In that
+     *  case the data has to stay valid as long as the fragment is used, and
+     *  a const fragment must not be accessed from several threads at once.
+     */
+    enum Decoding { DecodeAll, DecodeOnDemand };
+
+    TrackerDataFragment( const uint32_t *data, size_t size, Decoding decoding = DecodeAll );
+    /// Decode everything right away, spreading the modules over the threads of pool
+    TrackerDataFragment( const uint32_t *data, size_t size, DAQFormats::TaskPool& pool );
+
+    void DecodeModuleData() const;
+    void DecodeModuleData(DAQFormats::TaskPool& pool) const;
 
     bool valid() const; 
 
@@ -189,22 +313,27 @@ struct TrackerDataFragment
     size_t size() const { return m_size; }
     uint8_t trb_error_id() const { return event.m_trb_error_id;}
     std::vector<uint8_t>  module_error_id() const { return event.m_module_error_ids;}
-    std::map< std::pair<uint8_t, uint8_t>,std::vector<uint32_t> >  module_modDB() const {return  event.m_modDB;}
+    /// Undecoded 24-bit data words of one module side (0 = LED, 1 = LEDX)
+    const uint32_t* module_data(size_t module, size_t side) const { return event.m_moduleWords.data() + event.m_moduleRanges[module][side].offset; }
+    size_t module_data_size(size_t module, size_t side) const { return event.m_moduleRanges[module][side].length; }
+    /// Copy of all undecoded module data keyed by (module, side), for debugging
+    std::map< std::pair<uint8_t, uint8_t>,std::vector<uint32_t> >  module_modDB() const;
 
-    bool hasData(size_t module) const { return (event.GetModule(module) != nullptr); }
-    const SCTEvent& operator[](size_t module) const { return *event.GetModule(module); }
+    bool hasData(size_t module) const { DecodeModule(static_cast<uint8_t>(module)); return (event.GetModule(module) != nullptr); }
+    const SCTEvent& operator[](size_t module) const { DecodeModule(static_cast<uint8_t>(module)); return *event.GetModule(module); }
 
-    using const_iterator = std::vector<std::shared_ptr<SCTEvent>>::const_iterator;
-    using iterator = std::vector<std::shared_ptr<SCTEvent>>::iterator;
+    /// Iteration over all modules gives a pointer to each, nullptr for modules without data
+    using const_iterator = std::array<SCTEvent*, MODULES_PER_FRAGMENT>::const_iterator;
+    using iterator = std::array<SCTEvent*, MODULES_PER_FRAGMENT>::iterator;
 
-    const_iterator cbegin() const { return event.m_hits_per_module.cbegin(); }
+    const_iterator cbegin() const { DecodeModuleData(); return event.m_hits_per_module.cbegin(); }
     const_iterator cend() const { return event.m_hits_per_module.cend(); }
-    iterator begin() { return event.m_hits_per_module.begin(); }
+    iterator begin() { DecodeModuleData(); return event.m_hits_per_module.begin(); }
     iterator end() { return event.m_hits_per_module.end(); }
 
     bool has_trb_error() const { return event.m_has_trb_error; }
     bool has_module_error() const { return event.m_module_error_ids.size() > 0; }
-    bool has_crc_error() const { return event.m_crc != event.m_crc_calculated; }
+    bool has_crc_error() const { return event.m_crc != crc_calculated(); }
     bool missing_event_id() const { return event.m_event_id_missing; }
     bool missing_bcid() const { return event.m_bc_id_missing; }
     bool missing_crc() const { return event.m_crc_missing; }
@@ -218,32 +347,74 @@ struct TrackerDataFragment
     TrackerDataFragment(const TrackerDataFragment& other) = delete;
     TrackerDataFragment& operator=(const TrackerDataFragment& other) = delete;
 
+  protected:
+    /// Empty fragment, to be filled with Decode()
+    TrackerDataFragment() : m_data(nullptr), m_size(0) {}
+
+    /// Replace the content by the decoding of new data, reusing the memory already allocated
+    void Decode( const uint32_t *data, size_t size, Decoding decoding, DAQFormats::TaskPool* pool );
+
   private:
+    bool DecodeTRBWord(const uint32_t *data, size_t i);
+    void TraceWords(const uint32_t *data, size_t& from, size_t to) const;
+    void DecodeModule(uint8_t module) const;
+    void DecodeBitstreams(uint8_t module) const;
+    uint32_t crc_calculated() const;
+
+    const uint32_t* m_data;
     size_t m_size;
+    mutable uint8_t m_decodedModules {0}; // bit per module
+    mutable bool m_crcCalculated {false};
+    TRBFrameScan m_frames;
 
     struct TRBEvent 
     {
     public:
-        TRBEvent() {}
-        std::shared_ptr<SCTEvent> GetModule(size_t moduleID) const { return m_hits_per_module[moduleID]; }
-        void SetModule(size_t moduleID, std::shared_ptr<SCTEvent> sctEvent) { m_hits_per_module[moduleID] = sctEvent; }
-
-        ~TRBEvent();
+        TRBEvent() { Reset(); }
+        void Reset() {
+          m_event_id = 0xffffff;
+          m_bc_id = 0xffff;
+          m_has_trb_error = false;
+          m_event_id_missing = true;
+          m_bc_id_missing = true;
+          m_crc_missing = true;
+          m_frame_counter_invalid = false;
+          m_unrecognized_frames = false;
+          m_trb_error_id = 0;
+          m_crc = 0;
+          m_crc_calculated = 0;
+          m_module_error_ids.clear();
+          for (auto& sides : m_moduleRanges) for (auto& range : sides) range = WordRange();
+          m_hits_per_module.fill(nullptr);
+        }
+        SCTEvent* GetModule(size_t moduleID) const { return m_hits_per_module[moduleID]; }
+        SCTEvent* NewModule(uint8_t moduleID, unsigned int l1id, unsigned int bcid) const {
+          m_modules[moduleID].Reset(moduleID, l1id, bcid);
+          m_hits_per_module[moduleID] = &m_modules[moduleID];
+          return m_hits_per_module[moduleID];
+        }
 
         uint32_t m_event_id;
         uint32_t m_bc_id;
-        bool m_has_trb_error {false};
-        bool m_event_id_missing {true};
-        bool m_bc_id_missing {true};
-        bool m_crc_missing {true};
-        bool m_frame_counter_invalid {false};
-        bool m_unrecognized_frames {false};
-        uint8_t m_trb_error_id {0};
+        bool m_has_trb_error;
+        bool m_event_id_missing;
+        bool m_bc_id_missing;
+        bool m_crc_missing;
+        bool m_frame_counter_invalid;
+        bool m_unrecognized_frames;
+        uint8_t m_trb_error_id;
         uint32_t m_crc;
-        uint32_t m_crc_calculated;
+        mutable uint32_t m_crc_calculated;
         std::vector< uint8_t > m_module_error_ids;
-        std::map< std::pair<uint8_t, uint8_t>, std::vector<uint32_t> > m_modDB;
-        std::vector < std::shared_ptr<SCTEvent> > m_hits_per_module { nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
+        struct WordRange {
+          uint32_t offset {0};
+          uint32_t length {0};
+        };
+        std::vector< uint32_t > m_moduleWords; // module data words grouped by module and side
+        WordRange m_moduleRanges[MODULES_PER_FRAGMENT][SIDES_PER_MODULE];
+        // filled while decoding, which may happen on access
+        mutable std::array < SCTEvent, MODULES_PER_FRAGMENT > m_modules;
+        mutable std::array < SCTEvent*, MODULES_PER_FRAGMENT > m_hits_per_module; // points into m_modules for modules with data
 
         // prohibit copy and assign
         TRBEvent(const TRBEvent& other) = delete;
@@ -254,31 +425,107 @@ struct TrackerDataFragment
 
 };
 
+/** \brief Tracker decoder to be reused for many fragments
+ *
+ *  decode() replaces the content of the previous fragment while keeping all
+ *  buffers, so after the first few fragments decoding does not allocate
+ *  memory any more. All accessors of TrackerDataFragment can be used.
+ */
+class TrackerDecoder : public TrackerDataFragment
+{
+  public:
+    TrackerDecoder() {}
+
+    void decode( const uint32_t *data, size_t size, Decoding decoding = DecodeAll ) { Decode(data, size, decoding, nullptr); }
+    void decode( const uint32_t *data, size_t size, DAQFormats::TaskPool& pool ) { Decode(data, size, DecodeAll, &pool); }
+};
+
+/** \brief Bit reader over the 24-bit payload words of one module side
+ *
+ *  The words are not copied, so they have to stay valid while the stream is
+ *  used. Bits are kept MSB-first in a 64-bit accumulator that is topped up
+ *  with whole payload words, so peek() and consume() take constant time.
+ */
 class Bitstream {
     public:
-        Bitstream(std::vector<uint32_t> data);
+        Bitstream(const uint32_t* data, size_t nWords);
 
-        void Add(Bitstream stream) {m_bitstreamData.insert(m_bitstreamData.end(), stream.GetDataVector().begin(), stream.GetDataVector().end()); }
-        void FillData(std::vector<uint32_t> data){ m_bitstreamData = data;}
-        void RemoveBits(unsigned int n);
-        uint32_t GetWord32() const {return m_currentBuffer;}
-        std::vector<uint32_t> GetDataVector() const {return m_bitstreamData;}
+        /// Next 32 bits of the stream, zero padded at the end
+        uint32_t peek() const {return static_cast<uint32_t>(m_accumulator >> 32);}
+        /// Drop the next n bits (n <= 32)
+        void consume(unsigned int n);
+        /// Same as calling consume(n) the given number of times (n * times <= 32)
+        void consume(unsigned int n, unsigned int times);
+
+        void RemoveBits(unsigned int n) {consume(n);}
+        uint32_t GetWord32() const {return peek();}
         bool BitsAvailable() const {return (m_bitsAvailable > 0);}
-        unsigned int NBitsAvailable() const {return m_bitsAvailable;}
-        unsigned int AvailableWords() const {return m_bitstreamData.size();}
+        unsigned int NBitsAvailable() const {return static_cast<unsigned int>(m_bitsAvailable);}
+        unsigned int AvailableWords() const {return static_cast<unsigned int>(m_nWords - m_frontWord);}
 
         Bitstream(const Bitstream& other) = delete;
         Bitstream& operator=(const Bitstream& other) = delete;
 
     private:
-        uint32_t m_currentBuffer;
-        std::vector<uint32_t> m_bitstreamData;
-        unsigned int m_bitsUsedOfNextWord;
+        void refill();
+        void countBits(unsigned int n);
+
+        const uint32_t* m_data;
+        size_t m_nWords;
+        size_t m_nextWord;          // first word not yet loaded into the accumulator
+        uint64_t m_accumulator;
+        unsigned int m_accumulatorBits;
+        // word and bits of it behind the 32-bit window, only used to count the available bits
+        size_t m_frontWord;
+        unsigned int m_frontBitsUsed;
         long m_bitsAvailable;
 
-        const unsigned int m_usedBitsPerWord = 24;
+        static const unsigned int m_usedBitsPerWord = 24;
+        static const uint32_t MASK_WORD = 0xFFFFFF;
 };
 
+/** \brief Type of the SCT module packet at the start of a 32-bit window
+ *
+ *  The top INDEX_BITS bits select the type in a table built at compile time
+ *  from the MASK_MODULE_* and TAG_MODULE_* constants, leaving a single mask
+ *  comparison to confirm it. Windows whose top bits fit several types are
+ *  compared with each type in turn, in the order header, error, config,
+ *  data, no data and trailer, as the decoder has always done.
+ */
+class SCTPacketTable {
+  public:
+    enum Kind : uint8_t { Unknown, Header, Error, Config, Data, NoData, Trailer, Ambiguous };
+
+    static Kind classify(uint32_t word) {
+      Kind kind = TABLE[word >> (32 - INDEX_BITS)];
+      if (kind == Ambiguous) return classifyInTurn(word);
+      return ((word & RULES[kind].mask) == RULES[kind].tag) ? kind : Unknown;
+    }
+    static constexpr Kind classifyInTurn(uint32_t word);
+
+  private:
+    static const unsigned int INDEX_BITS = 11;
+    static const size_t TABLE_SIZE = size_t(1) << INDEX_BITS;
+    static const uint32_t INDEX_MASK = ~uint32_t(0) << (32 - INDEX_BITS);
+
+    struct Rule {
+      uint32_t mask;
+      uint32_t tag;
+    };
+    // indexed by Kind, the Unknown entry never matches
+    static constexpr Rule RULES[Ambiguous] = {
+      {0, 1},
+      {TrackerDataFragment::MASK_MODULE_HEADER, TrackerDataFragment::TAG_MODULE_HEADER},
+      {TrackerDataFragment::MASK_MODULE_ERROR, TrackerDataFragment::TAG_MODULE_ERROR},
+      {TrackerDataFragment::MASK_MODULE_CONFIG, TrackerDataFragment::TAG_MODULE_CONFIG},
+      {TrackerDataFragment::MASK_MODULE_DATA, TrackerDataFragment::TAG_MODULE_DATA},
+      {TrackerDataFragment::MASK_MODULE_NODATA, TrackerDataFragment::TAG_MODULE_NODATA},
+      {TrackerDataFragment::MASK_MODULE_TRAILER, TrackerDataFragment::TAG_MODULE_TRAILER}
+    };
+
+    static constexpr std::array<Kind, TABLE_SIZE> makeTable();
+    static const std::array<Kind, TABLE_SIZE> TABLE;
+};
 
 #include "TrackerDataFragment.icc" 
 
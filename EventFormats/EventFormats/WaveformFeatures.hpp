@@ -0,0 +1,181 @@
+/*
+  Copyright (C) 2019-2020 CERN for the benefit of the FASER collaboration
+*/
+
+///////////////////////////////////////////////////////////////////
+// WaveformFeatures.hpp, (c) FASER Detector software
+///////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include "EventFormats/CpuFeatures.hpp"
+#include "EventFormats/DigitizerDataFragment.hpp"
+
+/** \brief Pulse features of the waveform of one digitizer channel
+ *
+ *  PMT pulses go down from the baseline, so amplitude, integral and time over
+ *  threshold are all measured below it. The baseline is taken from the first
+ *  samples, before the trigger. After that a single pass over the waveform
+ *  finds the lowest sample, the sum of all samples and the number of samples
+ *  below the threshold, with AVX2 on x86-64 CPUs that have it and plain C++
+ *  elsewhere. Both give identical results.
+ */
+struct WaveformFeatures
+{
+  struct Config {
+    Config(size_t baseline = 50, double thresholdCounts = 10) : baseline_samples(baseline), threshold(thresholdCounts) {}
+    size_t baseline_samples; ///< samples at the start of the waveform used for the baseline
+    double threshold;        ///< ADC counts below the baseline for time_over_threshold, not negative
+  };
+
+  double baseline_mean {0};
+  double baseline_rms {0};          ///< standard deviation of the baseline samples
+  double amplitude {0};             ///< baseline_mean minus the lowest sample
+  uint32_t peak_time {0};           ///< sample number of the lowest sample, the first one if there are several
+  double integral {0};              ///< sum of baseline_mean minus the sample, over all samples
+  uint32_t time_over_threshold {0}; ///< number of samples more than threshold below the baseline
+
+  static WaveformFeatures compute(const DigitizerData::ChannelView& samples, const Config& config = Config()) {
+    WaveformFeatures features;
+    size_t n = samples.size();
+    if (n == 0) return features;
+
+    size_t nBaseline = std::min(config.baseline_samples, n);
+    if (nBaseline) {
+      uint64_t sum = 0, sum2 = 0;
+      for (size_t i = 0; i < nBaseline; i++) {
+        sum += samples[i];
+        sum2 += static_cast<uint64_t>(samples[i]) * samples[i];
+      }
+      double count = static_cast<double>(nBaseline);
+      features.baseline_mean = static_cast<double>(sum) / count;
+      double variance = static_cast<double>(sum2) / count - features.baseline_mean * features.baseline_mean;
+      features.baseline_rms = variance > 0 ? std::sqrt(variance) : 0;
+    }
+
+    // sample < baseline - threshold is the same as sample < ceil(baseline - threshold) for integer samples
+    double cut = std::ceil(features.baseline_mean - config.threshold);
+    Pass pass = run(samples.data(), n, static_cast<uint16_t>(std::min(std::max(cut, 0.), 65535.)));
+    features.amplitude = features.baseline_mean - pass.min;
+    features.peak_time = pass.min_index;
+    features.integral = static_cast<double>(n) * features.baseline_mean - static_cast<double>(pass.sum);
+    features.time_over_threshold = pass.below;
+    return features;
+  }
+
+  /// Features of all enabled channels of a DigitizerDataFragment or DigitizerView, returns the mask of channels filled
+  template <typename Fragment>
+  static uint32_t compute(const Fragment& fragment, std::array<WaveformFeatures, N_MAX_CHAN>& features, const Config& config = Config()) {
+    std::array<Config, N_MAX_CHAN> configs;
+    configs.fill(config);
+    return compute(fragment, features, configs);
+  }
+
+  /// Same with a separate configuration for each channel
+  template <typename Fragment>
+  static uint32_t compute(const Fragment& fragment, std::array<WaveformFeatures, N_MAX_CHAN>& features, const std::array<Config, N_MAX_CHAN>& configs) {
+    uint32_t filled = 0;
+    for (int channel = 0; channel < N_MAX_CHAN; channel++) {
+      size_t index = static_cast<size_t>(channel);
+      if (!fragment.channel_has_data(channel)) {
+        features[index] = WaveformFeatures();
+        continue;
+      }
+      features[index] = compute(fragment.channel_adc_counts(channel), configs[index]);
+      filled |= 1u << channel;
+    }
+    return filled;
+  }
+
+  /// Results of the pass over all samples
+  struct Pass {
+    uint64_t sum {0};
+    uint16_t min {0xFFFF};
+    uint32_t min_index {0};
+    uint32_t below {0}; ///< samples less than the cut
+  };
+
+  static Pass run(const uint16_t* samples, size_t n, uint16_t cut) {
+#ifdef EVENTFORMATS_X86_SIMD
+    if (CpuFeatures::avx2()) return passAVX2(samples, n, cut);
+#endif
+    return passScalar(samples, 0, n, cut, Pass());
+  }
+
+  /// Continue the pass with samples from begin to n
+  static Pass passScalar(const uint16_t* samples, size_t begin, size_t n, uint16_t cut, Pass pass) {
+    for (size_t i = begin; i < n; i++) {
+      pass.sum += samples[i];
+      if (samples[i] < pass.min) {
+        pass.min = samples[i];
+        pass.min_index = static_cast<uint32_t>(i);
+      }
+      if (samples[i] < cut) pass.below++;
+    }
+    return pass;
+  }
+
+#ifdef EVENTFORMATS_X86_SIMD
+  /** \brief Pass over blocks of 16 samples, the rest is left to passScalar()
+   *
+   *  Each lane keeps its lowest sample and the block in which it first came,
+   *  and sums in 32 bits. Blocks are taken in chunks small enough that neither
+   *  the block numbers nor the sums overflow.
+   */
+  __attribute__((target("avx2")))
+  static Pass passAVX2(const uint16_t* samples, size_t n, uint16_t cut) {
+    const size_t CHUNK_BLOCKS = 32768;
+    const __m256i cutVec = _mm256_set1_epi16(static_cast<short>(cut));
+    const __m256i zero = _mm256_setzero_si256();
+    Pass pass;
+    size_t i = 0;
+    while (i + 16 <= n) {
+      size_t blocks = std::min((n - i) / 16, CHUNK_BLOCKS);
+      __m256i minVec = _mm256_set1_epi16(-1);
+      __m256i minBlock = zero;
+      __m256i sumVec = zero;
+      __m256i notBelow = zero;
+      for (size_t block = 0; block < blocks; block++) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(samples + i + 16 * block));
+        sumVec = _mm256_add_epi32(sumVec, _mm256_add_epi32(_mm256_unpacklo_epi16(x, zero), _mm256_unpackhi_epi16(x, zero)));
+        __m256i notLower = _mm256_cmpeq_epi16(_mm256_max_epu16(x, minVec), x); // x >= current minimum
+        minBlock = _mm256_blendv_epi8(_mm256_set1_epi16(static_cast<short>(block)), minBlock, notLower);
+        minVec = _mm256_min_epu16(x, minVec);
+        notBelow = _mm256_sub_epi16(notBelow, _mm256_cmpeq_epi16(_mm256_max_epu16(x, cutVec), x));
+      }
+
+      alignas(32) uint16_t laneMin[16], laneBlock[16], laneNotBelow[16];
+      alignas(32) uint32_t laneSum[8];
+      _mm256_store_si256(reinterpret_cast<__m256i*>(laneMin), minVec);
+      _mm256_store_si256(reinterpret_cast<__m256i*>(laneBlock), minBlock);
+      _mm256_store_si256(reinterpret_cast<__m256i*>(laneNotBelow), notBelow);
+      _mm256_store_si256(reinterpret_cast<__m256i*>(laneSum), sumVec);
+      uint16_t chunkMin = 0xFFFF;
+      size_t chunkIndex = 0;
+      size_t notBelowCount = 0;
+      for (size_t lane = 0; lane < 16; lane++) {
+        size_t index = 16 * laneBlock[lane] + lane;
+        if (laneMin[lane] < chunkMin || (laneMin[lane] == chunkMin && index < chunkIndex)) {
+          chunkMin = laneMin[lane];
+          chunkIndex = index;
+        }
+        notBelowCount += laneNotBelow[lane];
+      }
+      for (size_t lane = 0; lane < 8; lane++) pass.sum += laneSum[lane];
+      // lanes that never saw anything below 0xFFFF point to block 0, which is right if all samples are 0xFFFF
+      if (chunkMin < pass.min || (i == 0 && chunkMin == pass.min)) {
+        pass.min = chunkMin;
+        pass.min_index = static_cast<uint32_t>(i + chunkIndex);
+      }
+      pass.below += static_cast<uint32_t>(16 * blocks - notBelowCount);
+      i += 16 * blocks;
+    }
+    return passScalar(samples, i, n, cut, pass);
+  }
+#endif
+};
@@ -1,5 +1,8 @@
 #include "EventFormats/DAQFormats.hpp"
+#include "EventFormats/EventFileReader.hpp"
 #include <getopt.h>
+#include <algorithm>
+#include <vector>
 #include "EventFormats/TLBDataFragment.hpp"
 #include "EventFormats/TLBMonitoringFragment.hpp"
 #include "EventFormats/DigitizerDataFragment.hpp"
@@ -12,11 +15,13 @@ using namespace TLBMonFormat;
 using namespace BOBRDataFormat;
 using namespace TrackerData;
 static void usage() {
-   std::cout<<"Usage: eventDump [-f] [-d TLB/TRB/Digitizer/BOBR/all] [-n nEventsMax] --debug <filename>\n"
+   std::cout<<"Usage: eventDump [-f] [-d TLB/TRB/Digitizer/BOBR/all] [-n nEventsMax] --debug --headers-only <filename>\n"
               "   -f:                 print fragment header information\n"
               "   -d <subdetector>:   print full event information for subdetector\n"
               "   -n <no. events>:    print only first n events\n"
-              "   --debug:            set TLB and tracker decoders to debug mode\n"; 
+              "   --debug:            set TLB and tracker decoders to debug mode\n"
+              "   --headers-only:     fast scan reading only event headers, and fragment\n"
+              "                       headers with -f. Payloads are skipped, -d is ignored\n"; 
    exit(1);
 }
 
@@ -33,9 +38,11 @@ int main(int argc, char **argv) {
   bool showBOBR=false;
   int nEventsMax = -1;
   static int debug_mode;
+  static int headers_only;
   int opt;
   static struct option long_options[] = {
     {"debug", no_argument, &debug_mode, 1},
+    {"headers-only", no_argument, &headers_only, 1},
     {nullptr, no_argument, nullptr, 0}
   };
 
@@ -112,34 +119,41 @@ int main(int argc, char **argv) {
     usage();
   }
   std::string filename(argv[optind]);
-  std::ifstream in(filename, std::ios::binary);
-  if (!in.is_open()){
+  if (headers_only && showData) {
+    std::cout<<"Header-only scan, not dumping data"<<std::endl;
+    showData = false;
+  }
+  EventFileReader reader(filename, headers_only ? EventFileReader::HeadersOnly : EventFileReader::Sequential);
+  if (!reader.is_open()){
     std::cout << "ERROR: can't open file "<<filename<<std::endl;
     return 1;
   }
   
   int nEventsRead=0;
+  std::vector<FragmentView> fragments;
   
-  while(in.good() and in.peek()!=EOF) {
-    try {
-      EventFull event(in);
+  try {
+    for(const EventView& event : reader) {
       std::cout<<event<<std::endl;
       if (showFragments) {
-      for(const auto &id :event.getFragmentIDs()) {
-        const EventFragment* frag=event.find_fragment(id);
-        std::cout<<*frag<<std::endl;
+      // fragments are shown by source id, not in the order they were stored
+      fragments.assign(event.begin(), event.end());
+      std::stable_sort(fragments.begin(), fragments.end(),
+                       [](const FragmentView& a, const FragmentView& b) { return a.source_id()<b.source_id(); });
+      for(const FragmentView& frag : fragments) {
+        std::cout<<frag<<std::endl;
         if (showData) {
-          switch (frag->source_id()&0xFFFF0000) {
+          switch (frag.source_id()&0xFFFF0000) {
           case TriggerSourceID:
             if(showData && showTLB){
               if (event.event_tag() == PhysicsTag ) {
-                TLBDataFragment tlb_data_frag = TLBDataFragment(frag->payload<const uint32_t*>(), frag->payload_size());
+                TLBDataFragment tlb_data_frag = TLBDataFragment(frag.payload<const uint32_t*>(), frag.payload_size());
                 if (debug_mode) tlb_data_frag.set_debug_on();
                 std::cout<<"TLB data fragment:"<<std::endl;
                 std::cout<<tlb_data_frag<<std::endl;
               }
               else if (event.event_tag() == TLBMonitoringTag ) {
-                TLBMonitoringFragment tlb_mon_frag = TLBMonitoringFragment(frag->payload<const uint32_t*>(), frag->payload_size());
+                TLBMonitoringFragment tlb_mon_frag = TLBMonitoringFragment(frag.payload<const uint32_t*>(), frag.payload_size());
                 if (debug_mode) tlb_mon_frag.set_debug_on();
                 std::cout<<"TLB monitoring fragment:"<<std::endl;
                 std::cout<<tlb_mon_frag<<std::endl;
@@ -149,7 +163,7 @@ int main(int argc, char **argv) {
           case TrackerSourceID:
             if(showData && showTRB){
               try {
-                TrackerDataFragment tracker_data_frag(frag->payload<const uint32_t*>(), frag->payload_size());
+                TrackerDataFragment tracker_data_frag(frag.payload<const uint32_t*>(), frag.payload_size());
                 if (debug_mode) tracker_data_frag.set_debug_on();
                 std::cout<<"Tracker data fragment:"<<std::endl;
                 std::cout<<tracker_data_frag<<std::endl;
@@ -171,7 +185,7 @@ int main(int argc, char **argv) {
           case PMTSourceID:
             if(showData && showDigitizer){
               if (event.event_tag() == PhysicsTag ) {
-                DigitizerDataFragment digitizer_data_frag = DigitizerDataFragment(frag->payload<const uint32_t*>(), frag->payload_size());
+                DigitizerDataFragment digitizer_data_frag = DigitizerDataFragment(frag.payload<const uint32_t*>(), frag.payload_size());
                 std::cout<<"Digitizer data fragment:"<<std::endl;
                 std::cout<<digitizer_data_frag<<std::endl;
               }
@@ -179,15 +193,15 @@ int main(int argc, char **argv) {
             break;
           case BOBRSourceID:
             if(showData && showBOBR){
-	      BOBRDataFragment bobr_data_frag = BOBRDataFragment(frag->payload<const uint32_t*>(), frag->payload_size());
+	      BOBRDataFragment bobr_data_frag = BOBRDataFragment(frag.payload<const uint32_t*>(), frag.payload_size());
 	      std::cout<<"BOBR data fragment:"<<std::endl;
 	      std::cout<<bobr_data_frag<<std::endl;
             }
             break;
           default:
-            const uint32_t* payload=frag->payload<const uint32_t *>();
+            const uint32_t* payload=frag.payload<const uint32_t *>();
             unsigned int ii=0;
-            for(;ii<frag->payload_size()/4;ii++) {
+            for(;ii<frag.payload_size()/4;ii++) {
           if (ii%8==0) std::cout<<" ";
           std::cout<<" 0x"<<std::setw(8)<<std::hex<<std::setfill('0')<<payload[ii];
           if (ii%8==7) std::cout<<std::endl;
@@ -199,17 +213,17 @@ int main(int argc, char **argv) {
           }
         }	
       }
-    } catch (EFormatException &e) {
-      std::cout<<"Problem while reading file - "<<e.what()<<std::endl;
-      return 1;
-    }
     
-    // read up to nEventsMax if specified
-    nEventsRead++;
-    if(nEventsMax!=-1 && nEventsRead>=nEventsMax){
-      std::cout<<"Finished reading specified number of events : "<<nEventsMax<<std::endl;
-      break;
-    }
+      // read up to nEventsMax if specified
+      nEventsRead++;
+      if(nEventsMax!=-1 && nEventsRead>=nEventsMax){
+        std::cout<<"Finished reading specified number of events : "<<nEventsMax<<std::endl;
+        break;
+      }
     
+    }
+  } catch (EFormatException &e) {
+    std::cout<<"Problem while reading file - "<<e.what()<<std::endl;
+    return 1;
   }
 }
@@ -1,16 +1,92 @@
 #include "EventFormats/DAQFormats.hpp"
+#include "EventFormats/EventFileReader.hpp"
+#include "EventFormats/EventIndex.hpp"
+#include "EventFormats/EventWriter.hpp"
+#include "EventFormats/EventFilter.hpp"
+#include "EventFormats/EventSelection.hpp"
 #include <getopt.h>
 #include "EventFormats/TLBDataFragment.hpp"
 #include "EventFormats/TLBMonitoringFragment.hpp"
 #include "EventFormats/DigitizerDataFragment.hpp"
 #include "EventFormats/TrackerDataFragment.hpp"
-#include <list>
-#include <algorithm>
+#include <set>
 
 using namespace DAQFormats;
 using namespace TLBDataFormat;
 using namespace TLBMonFormat;
 
+/// Selection applied to the index entries
+struct Selection {
+  std::set<uint64_t> event_list;
+  unsigned short mask;
+  int tag;
+  const EventSelection* expression;
+
+  /// Events not in our event list are not looked at
+  bool listed(const EventIndexEntry& entry) const {
+    return event_list.empty() || event_list.find(entry.event_counter) != event_list.end();
+  }
+
+  bool accept(const EventIndexEntry& entry) const {
+    // Skip events that don't pass trigger
+    if ((mask>0) && (entry.trigger_bits & mask) == 0) return false;
+
+    // Skip events with other tags
+    if ((tag>=0) && (entry.event_tag != tag)) return false;
+
+    return true;
+  }
+
+  /// Event to write for a listed entry, empty view if it fails the selection
+  EventView select(const EventFileReader& reader, const EventIndexEntry& entry) const {
+    if (!accept(entry)) return EventView();
+    EventView event = reader.event_at(entry.offset);
+    // Only now look at the fragments, decoding what the expression needs
+    if (expression && !expression->select(event)) return EventView();
+    return event;
+  }
+};
+
+/// Writes the selected events and decides when to stop, always called in input order
+class Output {
+public:
+  Output(EventWriter& out, size_t nListed, int nEventsMax) :
+    m_out(out), m_nListed(nListed), m_nEventsMax(nEventsMax),
+    m_nEventsWritten(0), m_nEventsFound(0), m_done(false) {}
+
+  /// Handle next listed event, empty if it failed the selection. Returns false once done
+  bool add(const EventView& event) {
+    if (m_nListed) m_nEventsFound++;
+    if (!event) return true;
+
+    // Have an event to write out
+    std::cout<<event<<std::endl;
+    m_out.write(event);
+
+    // write up to nEventsMax if specified
+    m_nEventsWritten++;
+    if(m_nEventsMax>0 && m_nEventsWritten>=m_nEventsMax){
+      std::cout<<"Finished reading specified number of events : "<<m_nEventsMax<<std::endl;
+      m_done=true;
+    }
+
+    // no need to look further if all requested events were found
+    if (m_nListed && m_nEventsFound==m_nListed) m_done=true;
+    return !m_done;
+  }
+
+  /// True if stopped before the end of the input
+  bool done() const { return m_done; }
+
+private:
+  EventWriter& m_out;
+  size_t m_nListed;
+  int m_nEventsMax;
+  int m_nEventsWritten;
+  size_t m_nEventsFound;
+  bool m_done;
+};
+
 static void usage() {
    std::cout<<"Usage: eventFilter [-n nEvents] [-e evnum] <infile> <outfile>\n"
               "   -a                  append (rather than overwrite) output file\n"
@@ -19,6 +95,21 @@ static void usage() {
               "                       comma-separated list of events, or ranges\n"
               "   -t <mask>:          only write events satisfying (mask | trigger)\n"
               "                       specify mask in hex format: 0xFF, \n"
+              "   -T <tag>:           only write events with given event tag\n"
+              "   -s <expression>:    only write events passing selection on decoded data,\n"
+              "                       e.g. \"(tlb.tap & 0x4) && trk.hits[1] >= 5\", see\n"
+              "                       EventSelection.hpp for the available quantities\n"
+              "   -i                  write sidecar index <infile>.idx if missing\n"
+              "   -x                  write sidecar index for output file(s)\n"
+              "   -r <no. events>:    start new output file after n events\n"
+              "   -R <MB>:            start new output file before exceeding size\n"
+              "   -D                  write output with direct I/O, bypassing the page cache\n"
+              "   -j <threads>:       evaluate selection in n worker threads,\n"
+              "                       output is the same as with a single thread\n"
+              "\n"
+              "   Events are selected using the sidecar index <infile>.idx if present,\n"
+              "   otherwise the index is built from a scan of the event headers.\n"
+              "   With -r or -R, output files are named <outstem>-NNNNN<outext>.\n"
      ;
    exit(1);
 }
@@ -29,15 +120,20 @@ int main(int argc, char **argv) {
   if(argc<3) usage();
 
   int nEventsMax = -1;
-  std::list<int> event_list;
+  std::set<uint64_t> event_list;
 
   int opt;
   char* token;
   bool append = false;
   unsigned short mask = 0;
+  int tag = -1;
+  bool writeIndex = false;
+  EventWriterOptions writerOptions;
+  unsigned int nThreads = 1;
+  std::unique_ptr<EventSelection> expression;
 
   while (true) {
-    opt = getopt(argc, argv, "ad:n:e:t:");
+    opt = getopt(argc, argv, "ad:n:e:t:T:s:ixr:R:Dj:");
     if (opt == -1) break;
     switch ( opt ) {
 
@@ -69,14 +165,14 @@ int main(int argc, char **argv) {
 	std::size_t loc = tstr.find('-');
 	if (loc == std::string::npos) {
 	  // No hyphen, save run number
-	  event_list.push_back(std::stoi(tstr));
+	  event_list.insert(static_cast<uint64_t>(std::stoi(tstr)));
 	} else {
 	  // Yes hyphen, extract two run numbers and fill range to list
 	  int start = std::stoi(tstr.substr(0,loc));
 	  int end = std::stoi(tstr.substr(loc+1,tstr.size()-loc));
 	  std::cout<<"Found range from " << start << " to " << end << std::endl;
 	  for (int run=start; run <= end; run++)
-	    event_list.push_back(run);
+	    event_list.insert(static_cast<uint64_t>(run));
 	}
 
 	token = strtok(NULL, ",");
@@ -87,6 +183,43 @@ int main(int argc, char **argv) {
       sscanf(optarg, "%hx", &mask);
       break;
 
+    case 'T':
+      tag = std::atoi(optarg);
+      break;
+
+    case 's':
+      try {
+	expression.reset(new EventSelection(optarg));
+      } catch (ESelectionException &e) {
+	std::cout<<"ERROR: "<<e.what()<<std::endl;
+	return 1;
+      }
+      break;
+
+    case 'i':
+      writeIndex = true;
+      break;
+
+    case 'x':
+      writerOptions.write_index = true;
+      break;
+
+    case 'r':
+      writerOptions.max_events = std::strtoull(optarg, NULL, 10);
+      break;
+
+    case 'R':
+      writerOptions.max_file_size = std::strtoull(optarg, NULL, 10)*1024*1024;
+      break;
+
+    case 'D':
+      writerOptions.direct_io = true;
+      break;
+
+    case 'j':
+      nThreads = static_cast<unsigned int>(std::max(1, std::atoi(optarg)));
+      break;
+
     case ':':
       std::cout<<"Missing optarg : "<<optopt<<std::endl;
       break;
@@ -122,6 +255,12 @@ int main(int argc, char **argv) {
   }
   if (mask > 0)
     std::cout<<"Using trigger mask    : " << std::hex << mask << std::dec << std::endl;
+  if (tag >= 0)
+    std::cout<<"Using event tag       : " << tag << std::endl;
+  if (expression)
+    std::cout<<"Using selection       : " << expression->expression() << std::endl;
+  if (nThreads > 1)
+    std::cout<<"Using worker threads  : " << nThreads << std::endl;
 
   std::cout<<"Reading from file     : "<<infilename<<std::endl;
   if (append) {
@@ -131,58 +270,51 @@ int main(int argc, char **argv) {
   }
 
   // Open input and output files
-  std::ifstream in(infilename, std::ios::binary);
-  if (!in.is_open()){
+  EventFileReader reader(infilename);
+  if (!reader.is_open()){
     std::cout << "ERROR: can't open file "<<infilename<<std::endl;
     return 1;
   }
 
-  std::ios_base::openmode mode;
-  if (append) {
-    mode = std::ios::app;
-  } else {
-    mode = std::ios::trunc;
-  }
-  std::ofstream out(outfilename, std::ios::out | std::ios::binary | mode);
-  if (!out.is_open()){
+  writerOptions.append = append;
+  std::unique_ptr<EventWriter> out;
+  try {
+    out.reset(new EventWriter(outfilename, writerOptions));
+  } catch (EFormatException &e) {
     std::cout << "ERROR: can't open file "<<outfilename<<std::endl;
     return 1;
   }
   
-  int nEventsWritten=0;
-  
-  while(in.good() and in.peek()!=EOF) {
-    try {
-      EventFull event(in);
-
-      // Skip events not in our event list
-      if (!event_list.empty() && (std::find(event_list.begin(), event_list.end(), event.event_counter()) == event_list.end()))
-	  continue;
-
-      // Skip events that don't pass trigger
-      if ((mask>0) && (event.trigger_bits() & mask) == 0) continue;
-
-      // Have an event to write out
-      std::cout<<event<<std::endl;
-
-      byteVector* raw = event.raw();
-      out.write(reinterpret_cast<char*>(&(*raw)[0]), event.size());
+  // Selection only needs the event headers, which are all in the index
+  EventIndex index;
+  try {
+    index.open(reader, infilename, writeIndex);
+  } catch (EFormatException &e) {
+    std::cout<<"Problem while writing index - "<<e.what()<<std::endl;
+    return 1;
+  }
 
-      //std::cout << "Wrote Run: " << event.run_number()
-      //		<< " Event: " << event.event_counter() << std::endl;
-    } catch (EFormatException &e) {
-      std::cout<<"Problem while reading file - "<<e.what()<<std::endl;
-      return 1;
-    }
-    
-    // write up to nEventsMax if specified
-    nEventsWritten++;
-    if(nEventsMax>0 && nEventsWritten>=nEventsMax){
-      std::cout<<"Finished reading specified number of events : "<<nEventsMax<<std::endl;
-      break;
+  Selection selection{event_list, mask, tag, expression.get()};
+  Output output(*out, selection.event_list.size(), nEventsMax);
+  
+  try {
+    if (nThreads>1) {
+      filterParallel(reader, index, selection, output, nThreads);
+    } else {
+      for(const EventIndexEntry& entry : index) {
+	if (!selection.listed(entry)) continue;
+	if (!output.add(selection.select(reader, entry))) break;
+      }
     }
-    
+    out->close();
+  } catch (std::exception &e) {
+    std::cout<<"Problem while reading file - "<<e.what()<<std::endl;
+    return 1;
   }
-}
-
+  if (output.done()) return 0;
 
+  if (!index.complete()) {
+    std::cout<<"Problem while reading file - "<<index.error()<<std::endl;
+    return 1;
+  }
+}
@@ -1,7 +1,520 @@
 #include "Logging.hpp"
 #include "EventFormats/DAQFormats.hpp"
+#include "EventFormats/EventView.hpp"
+#include "EventFormats/EventSelection.hpp"
+#include "EventFormats/EventWriter.hpp"
+#include "EventFormats/EventFilter.hpp"
+#include "EventFormats/EventAssembler.hpp"
+#include "EventFormats/EventRing.hpp"
+#include "EventFormats/TRBFrameScan.hpp"
+#include "EventFormats/TrackerDataFragment.hpp"
+#include "EventFormats/FletcherChecksum.hpp"
+#include "EventFormats/SCTStripBitmap.hpp"
+#include "EventFormats/DigitizerDataFragment.hpp"
+#include "EventFormats/WaveformFeatures.hpp"
+#include "EventFormats/DigitizerCalibration.hpp"
+#include <unistd.h>
+
+using namespace DAQFormats;
 
 int main(int /*argc*/, char **/*argv*/) {
   INFO("an INFO message");
   ERROR("anm ERROR message");
+
+  // build a small event and check that the views see the same content
+  const uint32_t tlbPayload[]={0xFEAD00A0, 0x10000001, 0x20000002};
+  const uint32_t trbPayload[]={0x00000001, 0x40000002};
+  EventFull event(PhysicsTag, 1234, 42);
+  event.addFragment(new EventFragment(PhysicsTag, TriggerSourceID, 1, 100, tlbPayload, sizeof(tlbPayload)));
+  event.addFragment(new EventFragment(PhysicsTag, TrackerSourceID|2, 1, 100, trbPayload, sizeof(trbPayload)));
+  byteVector* raw=event.raw();
+
+  EventView view(raw->data(), raw->size());
+  INFO(view);
+  int errors=0;
+  if (view.event_counter()!=42 || view.run_number()!=1234 || view.fragment_count()!=2 ||
+      view.size()!=event.size()) {
+    ERROR("EventView header does not match EventFull");
+    errors++;
+  }
+  unsigned int nFrags=0;
+  for(const auto& frag : view) {
+    INFO(frag);
+    if (frag.payload<const uint8_t*>()<raw->data() || frag.payload<const uint8_t*>()>=raw->data()+raw->size()) {
+      ERROR("FragmentView payload does not point into the event buffer");
+      errors++;
+    }
+    nFrags++;
+  }
+  FragmentView trb=view.find_fragment(TrackerSourceID|2);
+  if (nFrags!=2 || !trb || trb.payload_size()!=sizeof(trbPayload) ||
+      trb.payload<const uint32_t*>()[1]!=trbPayload[1] || view.find_fragment(PMTSourceID)) {
+    ERROR("FragmentView content does not match EventFragment");
+    errors++;
+  }
+
+  // event loaded from header and payload separately has the same fragments
+  {
+    EventFull loaded;
+    uint16_t headerSize=loaded.loadHeader(raw->data(), raw->size());
+    loaded.loadPayload(raw->data()+headerSize, raw->size()-headerSize);
+    const EventFragment* tlb=loaded.find_fragment(TriggerSourceID);
+    if (loaded.fragment_count()!=2 || loaded.size()!=event.size() || !tlb ||
+	tlb->payload_size()!=sizeof(tlbPayload) || tlb->payload<const uint32_t*>()[2]!=tlbPayload[2]) {
+      ERROR("EventFull loaded in two steps does not match");
+      errors++;
+    }
+  }
+
+  // the fragment count is 8 bits, one more fragment is refused instead of wrapping
+  {
+    EventFull crowded(PhysicsTag, 1234, 43);
+    for(uint32_t ii=0; ii<EventFull::MaxFragments; ii++)
+      crowded.addFragment(new EventFragment(PhysicsTag, TrackerSourceID|ii, 1, 100, trbPayload, sizeof(trbPayload)));
+    std::unique_ptr<EventFragment> extra(new EventFragment(PhysicsTag, PMTSourceID, 1, 100, trbPayload, sizeof(trbPayload)));
+    try {
+      crowded.addFragment(extra.get());
+      extra.release();
+      ERROR("EventFull accepted more than 255 fragments");
+      errors++;
+    } catch (EFormatException &) {
+    }
+    if (crowded.fragment_count()!=EventFull::MaxFragments) {
+      ERROR("EventFull fragment count is wrong");
+      errors++;
+    }
+  }
+
+  // an event header claiming no size at all is rejected, readers would not move past it
+  {
+    byteVector corrupt(*raw);
+    reinterpret_cast<EventHeader*>(corrupt.data())->header_size=0;
+    reinterpret_cast<EventHeader*>(corrupt.data())->payload_size=0;
+    try {
+      EventView bad(corrupt.data(), corrupt.size(), true);
+      ERROR("EventView accepted event header without size");
+      errors++;
+    } catch (EFormatException &) {
+    }
+  }
+
+  // fragment headers are read in place, a truncated header or one claiming to be shorter is rejected
+  {
+    const uint8_t* trbData=trb.payload<const uint8_t*>()-trb.header_size();
+    try {
+      FragmentView bad(trbData, sizeof(EventFragmentHeader)-1, true);
+      ERROR("FragmentView accepted truncated fragment header");
+      errors++;
+    } catch (EFormatException &) {
+    }
+    byteVector corrupt(trbData, trbData+trb.size());
+    reinterpret_cast<EventFragmentHeader*>(corrupt.data())->header_size=8;
+    reinterpret_cast<EventFragmentHeader*>(corrupt.data())->payload_size=static_cast<uint32_t>(corrupt.size()-8);
+    try {
+      FragmentView bad(corrupt.data(), corrupt.size());
+      ERROR("FragmentView accepted fragment header size smaller than header");
+      errors++;
+    } catch (EFormatException &) {
+    }
+  }
+
+  // selection on header quantities and on missing fragments
+  EventSelection selection("event_counter == 42 && (trigger_bits | 0x2) && !digi.max[0]");
+  if (!selection.select(view) || selection.uses(EventSelection::Tracker) || !selection.uses(EventSelection::Digitizer) ||
+      EventSelection("run_number != 1234 || trk.hits[1] > 0").select(view)) {
+    ERROR("EventSelection gives wrong result");
+    errors++;
+  }
+  try {
+    EventSelection bad("trk.hits[4] > 0");
+    ERROR("EventSelection accepted invalid index");
+    errors++;
+  } catch (ESelectionException &) {
+  }
+
+  // errors in the selection workers or in the output stop the pipeline and reach the caller
+  {
+    std::string fileName="/tmp/faser-test-filter-"+std::to_string(getpid())+".raw";
+    {
+      EventWriter writer(fileName);
+      for(int ii=0; ii<1000; ii++) writer.write(view);
+      writer.close();
+    }
+    EventFileReader fileReader(fileName);
+    EventIndex fileIndex;
+    fileIndex.build(fileReader);
+    unlink(fileName.c_str());
+
+    struct AllSelection {
+      size_t failAt;
+      bool listed(const EventIndexEntry&) const { return true; }
+      EventView select(const EventFileReader& reader, const EventIndexEntry& entry) const {
+	if (entry.offset>=failAt) throw std::out_of_range("selection failed");
+	return reader.event_at(entry.offset);
+      }
+    };
+    struct WriterOutput {
+      EventWriter& writer;
+      bool add(const EventView& event) { writer.write(event); return true; }
+    };
+    EventWriterOptions fullOptions;
+    fullOptions.block_size=4096;
+    EventWriter fullWriter("/dev/full", fullOptions);
+    WriterOutput fullOutput{fullWriter};
+    try {
+      filterParallel(fileReader, fileIndex, AllSelection{fileReader.size()}, fullOutput, 4);
+      ERROR("Write error in parallel filter was not reported");
+      errors++;
+    } catch (EFormatException &) {
+    }
+
+    EventWriter nullWriter("/dev/null");
+    WriterOutput nullOutput{nullWriter};
+    try {
+      filterParallel(fileReader, fileIndex, AllSelection{fileReader.size()/2}, nullOutput, 4);
+      ERROR("Selection error in parallel filter was not reported");
+      errors++;
+    } catch (std::out_of_range &) {
+    }
+    if (fileIndex.size()!=1000 || nullWriter.events_written()!=fileIndex.size()/2) {
+      ERROR("Parallel filter did not write the events before the selection error");
+      errors++;
+    }
+  }
+
+  // events written to the shared ring are seen by readers, which skip what was overwritten
+  {
+    std::string ringName="/faser-test-ring-"+std::to_string(getpid());
+    EventRingWriter ringWriter(ringName, 16*raw->size());
+    EventRingReader ringReader(ringName);
+    EventView fromRing;
+    ringWriter.write(view);
+    ringWriter.write(event);
+    unsigned int nRead=0;
+    while (ringReader.next(fromRing)) {
+      if (fromRing.size()!=view.size() || memcmp(fromRing.data(), raw->data(), raw->size()) || !ringReader.still_valid()) {
+	ERROR("Event from shared ring does not match");
+	errors++;
+      }
+      nRead++;
+    }
+    for(int ii=0; ii<100; ii++) ringWriter.write(event);
+    while (ringReader.next(fromRing)) nRead++;
+    if (!ringReader.is_open() || nRead>=102 || nRead+ringReader.missed()!=102) {
+      ERROR("Shared ring reader did not see the expected events");
+      errors++;
+    }
+
+    // a restarted writer gets a new segment, attached readers keep the old one until they attach again
+    std::unique_ptr<EventRingWriter> restarted(new EventRingWriter(ringName, 4*raw->size()));
+    restarted->write(view);
+    ringWriter.write(view);
+    bool oldRingRead=ringReader.next(fromRing);
+    EventRingReader newReader(ringName);
+    if (!oldRingRead || ringReader.next(fromRing) || !ringReader.replaced() || newReader.replaced() ||
+	!newReader.is_open() || !newReader.next(fromRing) || fromRing.size()!=view.size()) {
+      ERROR("Shared ring readers did not follow writer restart");
+      errors++;
+    }
+
+    // a record with impossible size in a ring that is still valid is reported, not retried forever
+    std::string badName=ringName+"-bad";
+    EventRingWriter badWriter(badName, 4*raw->size());
+    EventRingReader badReader(badName);
+    badWriter.write(view);
+    int fd=shm_open(badName.c_str(), O_RDWR, 0);
+    void* addr=fd>=0 ? mmap(nullptr, sizeof(EventRingHeader)+sizeof(EventRingRecord), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (fd>=0) close(fd);
+    if (addr==MAP_FAILED) {
+      ERROR("Can not map shared ring to corrupt it");
+      errors++;
+    } else {
+      reinterpret_cast<EventRingRecord*>(static_cast<uint8_t*>(addr)+sizeof(EventRingHeader))->size=0;
+      munmap(addr, sizeof(EventRingHeader)+sizeof(EventRingRecord));
+      try {
+	badReader.next(fromRing);
+	ERROR("Shared ring reader accepted corrupted record");
+	errors++;
+      } catch (EFormatException &) {
+      }
+    }
+  }
+  delete raw;
+
+  // assembler hands out complete, duplicate and timed out events with the right tags
+  std::vector<std::unique_ptr<EventFull>> built;
+  EventAssembler assembler({TriggerSourceID, TrackerSourceID}, 1234, std::chrono::seconds(0),
+			   [&built](std::unique_ptr<EventFull> ev) { built.push_back(std::move(ev)); });
+  assembler.add(new EventFragment(PhysicsTag, TriggerSourceID, 1, 100, tlbPayload, sizeof(tlbPayload)));
+  assembler.add(new EventFragment(PhysicsTag, TrackerSourceID, 1, 100, trbPayload, sizeof(trbPayload)));
+  assembler.add(new EventFragment(PhysicsTag, TrackerSourceID, 2, 100, trbPayload, sizeof(trbPayload)));
+  assembler.add(new EventFragment(PhysicsTag, TrackerSourceID, 2, 100, trbPayload, sizeof(trbPayload)));
+  assembler.expire();
+  if (built.size()!=2 || built[0]->event_tag()!=PhysicsTag || built[0]->fragment_count()!=2 ||
+      built[1]->event_tag()!=IncompleteTag || built[1]->fragment_count()!=1 ||
+      (built[1]->event_header().status & (MissingFragment|DuplicateFragment))!=(MissingFragment|DuplicateFragment) ||
+      assembler.pending()) {
+    ERROR("EventAssembler did not build expected events");
+    errors++;
+  }
+
+  // all frame scans find the same TRB words and the same frame counter break
+  std::vector<uint32_t> trbWords={0x00000001, 0x40000002};
+  for(uint32_t ii=0; ii<60; ii++) trbWords.push_back((ii%3==0 ? 0x42000000 : 0x80000000|(ii%8)<<24)|ii);
+  trbWords.push_back(0x01000000);
+  for(size_t ii=0; ii<trbWords.size(); ii++) trbWords[ii]|=static_cast<uint32_t>(ii%8)<<27;
+  for(size_t bad : {trbWords.size(), size_t(45)}) {
+    std::vector<uint32_t> words(trbWords);
+    if (bad<words.size()) words[bad]^=0x08000000;
+    std::vector<uint32_t> scalar, sse, avx;
+    size_t firstScalar=TRBFrameScan::scanScalar(words.data(), 0, words.size(), scalar);
+    size_t firstSSE=firstScalar, firstAVX=firstScalar;
+#ifdef EVENTFORMATS_X86_SIMD
+    firstSSE=TRBFrameScan::scanSSE2(words.data(), words.size(), sse);
+    if (CpuFeatures::avx2()) firstAVX=TRBFrameScan::scanAVX2(words.data(), words.size(), avx);
+    else avx=scalar;
+#else
+    sse=avx=scalar;
+#endif
+    TrackerDataFragment tracker(words.data(), words.size()*sizeof(uint32_t));
+    size_t nTRB=0;
+    for(size_t ii=0; ii<bad; ii++) if (!(words[ii]&0x80000000)) nTRB++;
+    if (firstScalar!=bad || firstSSE!=bad || firstAVX!=bad || scalar.size()!=nTRB ||
+	sse!=scalar || avx!=scalar || tracker.missing_frames()!=(bad<words.size())) {
+      ERROR("TRB frame scans disagree");
+      errors++;
+    }
+  }
+
+  // module packet table agrees with checking each packet type in turn
+  for(uint32_t top=0; top<2048; top++) {
+    for(uint32_t low : {0x0u, 0x2000u, 0x2010u, 0x1F0000u, 0x1FFFFFu, 0x12345u}) {
+      uint32_t word=top<<21|low;
+      if (SCTPacketTable::classify(word)!=SCTPacketTable::classifyInTurn(word)) {
+	ERROR("SCTPacketTable gives wrong packet type for "<<word);
+	errors++;
+      }
+    }
+  }
+
+  // digitizer samples come out in time order in aligned channel rows, also when reusing the decoder
+  DigitizerDecoder digitizer;
+  for(uint32_t words : {3u, 20u, 5u}) {
+    std::vector<uint32_t> pmt={0xA0000000|(4+2*words), 0x5, 0x0, 0x0};
+    for(uint32_t ii=0; ii<2*words; ii++) pmt.push_back((2*ii+1)<<16|(2*ii));
+    digitizer.decode(pmt.data(), pmt.size()*sizeof(uint32_t));
+    DigitizerDataFragment::ChannelView ch0=digitizer.channel_adc_counts(0);
+    DigitizerDataFragment::ChannelView ch2=digitizer.channel_adc_counts(2);
+    std::vector<uint16_t> copy=ch2;
+    if (ch0.size()!=2*words || ch2.size()!=2*words || !digitizer.channel_adc_counts(1).empty() ||
+	ch0[1]!=1 || ch2[0]!=2*words || copy.back()!=4*words-1 || reinterpret_cast<uintptr_t>(ch2.data())%32) {
+      ERROR("DigitizerDecoder samples are wrong");
+      errors++;
+    }
+    DigitizerView inPlace(pmt.data(), pmt.size()*sizeof(uint32_t));
+    DigitizerDataFragment::ChannelView direct=inPlace.channel_adc_counts(2);
+    if (std::vector<uint16_t>(direct)!=copy || inPlace.n_samples()!=2*words || !inPlace.channel_adc_counts(3).empty()) {
+      ERROR("DigitizerView samples are wrong");
+      errors++;
+    }
+#ifdef DIGITIZER_ZERO_COPY
+    if (direct.data()!=reinterpret_cast<const uint16_t*>(pmt.data()+4+words)) {
+      ERROR("DigitizerView copied the samples");
+      errors++;
+    }
+#endif
+  }
+
+  // waveform features of a pulse on a flat baseline, vectorized and scalar pass agree
+  {
+    std::vector<uint32_t> pmt={0xA0000000|(4+2*100), 0x3, 0x0, 0x0};
+    for(uint32_t ii=0; ii<2*100; ii++) {
+      uint32_t sample=2*(ii%100), low=1000-(sample>=120 && sample<130 ? 50+sample-120 : 0), high=1000-(sample+1>=120 && sample+1<130 ? 50+sample+1-120 : 0);
+      pmt.push_back(high<<16|low);
+    }
+    DigitizerView pulse(pmt.data(), pmt.size()*sizeof(uint32_t));
+    std::array<WaveformFeatures, N_MAX_CHAN> features;
+    uint32_t filled=WaveformFeatures::compute(pulse, features, WaveformFeatures::Config(50, 52.5));
+    DigitizerData::ChannelView ch1=pulse.channel_adc_counts(1);
+    WaveformFeatures::Pass vectorized=WaveformFeatures::run(ch1.data(), ch1.size(), 940);
+    WaveformFeatures::Pass scalar=WaveformFeatures::passScalar(ch1.data(), 0, ch1.size(), 940, WaveformFeatures::Pass());
+    if (filled!=0x3 || features[0].baseline_mean!=1000 || features[0].baseline_rms!=0 || features[0].amplitude!=59 ||
+	features[0].peak_time!=129 || features[0].integral!=545 || features[0].time_over_threshold!=7 ||
+	vectorized.sum!=scalar.sum || vectorized.min!=scalar.min || vectorized.min_index!=scalar.min_index || vectorized.below!=scalar.below) {
+      ERROR("WaveformFeatures are wrong");
+      errors++;
+    }
+
+    // calibration table as written by extractDigitizerScale.py: 2 V from run 100, channel 1 at 0.5 V from run 200
+    std::vector<uint8_t> table={'F','D','C','T', 1,0,0,0, 2,0,0,0};
+    for(uint32_t run : {100u, 200u}) {
+      for(int shift=0; shift<32; shift+=8) table.push_back(static_cast<uint8_t>(run>>shift));
+      for(int channel=0; channel<N_MAX_CHAN; channel++) {
+	float range=(run==200 && channel==1) ? 0.5f : 2.f;
+	uint32_t word;
+	memcpy(&word, &range, sizeof(word));
+	for(int shift=0; shift<32; shift+=8) table.push_back(static_cast<uint8_t>(word>>shift));
+      }
+    }
+    DigitizerCalibration calibration;
+    calibration.read(table.data(), table.size());
+    std::vector<float> mV(ch1.size());
+    std::vector<int32_t> uV(ch1.size());
+    calibration.calibrate(250, 1, ch1, static_cast<float>(features[1].baseline_mean), mV.data());
+    calibration.calibrate(150, 1, ch1, static_cast<float>(features[1].baseline_mean), uV.data());
+    bool tooEarly=false;
+    try {
+      calibration.range(99, 0);
+    } catch (DigitizerData::CalibrationException&) {
+      tooEarly=true;
+    }
+    if (!tooEarly || calibration.range(199, 1)!=2.f || calibration.range(1000, 0)!=2.f ||
+	mV[0]!=0 || mV[125]!=-55*500.f/16384 || uV[129]!=-7202 || uV[130]!=0) {
+      ERROR("DigitizerCalibration is wrong");
+      errors++;
+    }
+
+    // channels without readout settings are NaN in the table, a zero range is invalid as well
+    std::array<float, N_MAX_CHAN> ranges;
+    ranges.fill(2.f);
+    ranges[2]=std::nanf("");
+    ranges[3]=0.f;
+    calibration.add(300, ranges);
+    unsigned int nInvalid=0;
+    for(int channel : {2, 3}) {
+      try {
+	calibration.calibrate(300, channel, ch1, 0.f, mV.data());
+      } catch (DigitizerData::CalibrationException&) {
+	nInvalid++;
+      }
+    }
+    if (nInvalid!=2 || calibration.range(300, 4)!=2.f) {
+      ERROR("DigitizerCalibration accepted channel without valid range");
+      errors++;
+    }
+  }
+
+  // SCT modules through TrackerDataFragment: hits, an error, a config packet, a hit packet missing
+  // its leading bit and the trailers of module 3 are checked against the expected decoding, and
+  // decoding on a task pool or on demand gives the same for all modules
+  {
+    struct BitWriter {
+      std::vector<uint32_t> words;
+      uint32_t bits=0;
+      unsigned int nBits=0;
+      void put(uint32_t value, unsigned int n) {
+	while (n--) {
+	  bits=bits<<1|((value>>n)&1);
+	  if (++nBits==24) {
+	    words.push_back(bits);
+	    bits=0;
+	    nBits=0;
+	  }
+	}
+      }
+      void header() { put(0x3A,6); put(5,4); put(0x2A,8); put(1,1); } // L1ID 5, BCID 0x2A
+      void trailer() { put(0x8000,16); if (nBits) put(0, 24-nBits); }
+    };
+    const uint32_t module=3;
+    std::vector<uint32_t> trb={0x000123, 0x40000000|0x456};
+    for(uint32_t mod : {0u, 3u, 6u, 7u}) {
+      BitWriter led, ledx;
+      led.header();
+      ledx.header();
+      if (mod==module) {
+	led.put(1,2); led.put(2,4); led.put(10,7); led.put(0xA,4); led.put(0xB,4); led.put(0x9,4); // chip 2, strips 10-12
+	led.put(1,3);                                                                            // no hits
+	led.put(0,3); led.put(4,4); led.put(3,3); led.put(1,1);                                   // error 3 on chip 4
+	led.put(1,2); led.put(5,4); led.put(64,7); led.put(0x4,4); led.put(0xE,4);                 // leading bit missing, strip 64|7
+	ledx.put(1,2); ledx.put(9,4); ledx.put(127,7); ledx.put(0xF,4);                            // chip 9, strip 127
+	ledx.put(0,3); ledx.put(8,4); ledx.put(7,3); ledx.put(0x55,8); ledx.put(1,1); ledx.put(0xAA,8); ledx.put(1,1); // config
+      } else {
+	for(uint32_t chip=0; chip<6; chip++) {
+	  led.put(1,2); led.put(chip,4); led.put(16*mod+chip,7);
+	  for(uint32_t hit=0; hit<=chip+mod; hit++) led.put(0x8|(hit%7+1),4);
+	  ledx.put(1,2); ledx.put(8+chip,4); ledx.put(100-chip,7); ledx.put(0xC,4);
+	}
+	if (mod==6) { ledx.put(0,3); ledx.put(13,4); ledx.put(5,3); ledx.put(1,1); }
+      }
+      led.trailer();
+      ledx.trailer();
+      for(size_t ii=0; ii<std::max(led.words.size(), ledx.words.size()); ii++) {
+	if (ii<led.words.size()) trb.push_back(0x80000000|mod<<24|led.words[ii]);
+	if (ii<ledx.words.size()) trb.push_back(0xC0000000|mod<<24|ledx.words[ii]);
+      }
+    }
+    trb.push_back(0x01000000);
+    for(size_t ii=0; ii<trb.size(); ii++) trb[ii]|=static_cast<uint32_t>(ii%8)<<27;
+    trb.back()|=FletcherChecksum::ReturnFletcherChecksum(trb.data(), trb.size()*sizeof(uint32_t))&0xFFFFFF;
+
+    TrackerDataFragment sctFragment(trb.data(), trb.size()*sizeof(uint32_t));
+    std::vector<std::array<unsigned int,3>> hits, expectedHits={{2,10,2},{2,11,3},{2,12,1},{5,71,4},{5,72,6},{7,127,7}};
+    std::vector<std::array<unsigned int,2>> moduleErrors, expectedErrors={{4,3}};
+    unsigned int chip=0;
+    for(const auto& chipHits : sctFragment[module].GetHits()) {
+      for(const auto& hit : chipHits) hits.push_back({chip, hit.first, hit.second});
+      chip++;
+    }
+    chip=0;
+    for(const auto& chipErrors : sctFragment[module].GetErrors()) {
+      for(auto error : chipErrors) moduleErrors.push_back({chip, error});
+      chip++;
+    }
+    if (!sctFragment.valid() || sctFragment.has_crc_error() || sctFragment.hasData(2) || sctFragment[module].GetNHits()!=6 ||
+	sctFragment[module].GetL1ID()!=5 || sctFragment[module].GetBCID()!=0x2A || !sctFragment[module].HasError() ||
+	!sctFragment[module].IsComplete() || sctFragment[module].MissingData() || hits!=expectedHits || moduleErrors!=expectedErrors ||
+	sctFragment[7].GetNHits()!=69 || !sctFragment[6].HasError()) {
+      ERROR("TrackerDataFragment module decoding is wrong");
+      errors++;
+    }
+
+    auto sameModules=[](const TrackerDataFragment& first, const TrackerDataFragment& second) {
+      for(size_t mod=0; mod<TrackerDataFragment::MODULES_PER_FRAGMENT; mod++) {
+	if (first.hasData(mod)!=second.hasData(mod)) return false;
+	if (!first.hasData(mod)) continue;
+	const SCTEvent& a=first[mod];
+	const SCTEvent& b=second[mod];
+	if (a.GetL1ID()!=b.GetL1ID() || a.GetBCID()!=b.GetBCID() || a.HasError()!=b.HasError() || a.IsComplete()!=b.IsComplete() ||
+	    a.MissingData()!=b.MissingData() || a.BCIDMismatch()!=b.BCIDMismatch() || a.GetNHits()!=b.GetNHits()) return false;
+	for(size_t ii=0; ii<SCTEvent::CHIPS; ii++) {
+	  SCTEvent::HitRange hitsA=a.GetHits()[ii], hitsB=b.GetHits()[ii];
+	  SCTEvent::ErrorRange errorsA=a.GetErrors()[ii], errorsB=b.GetErrors()[ii];
+	  if (!std::equal(hitsA.begin(), hitsA.end(), hitsB.begin(), hitsB.end()) ||
+	      !std::equal(errorsA.begin(), errorsA.end(), errorsB.begin(), errorsB.end())) return false;
+	}
+      }
+      return true;
+    };
+    TaskPool pool(2);
+    TrackerDataFragment parallel(trb.data(), trb.size()*sizeof(uint32_t), pool);
+    TrackerDataFragment onDemand(trb.data(), trb.size()*sizeof(uint32_t), TrackerDataFragment::DecodeOnDemand);
+    TrackerDecoder decoder;
+    decoder.decode(trb.data(), trb.size()*sizeof(uint32_t), pool);
+    decoder.decode(trb.data(), trb.size()*sizeof(uint32_t), pool);
+    if (!sameModules(sctFragment, parallel) || !sameModules(sctFragment, onDemand) || !sameModules(sctFragment, decoder)) {
+      ERROR("Tracker modules decoded in parallel or on demand differ");
+      errors++;
+    }
+  }
+
+  // strip clusters, also across chip boundaries, with and without hit pattern filter
+  SCTEvent sct(0, 1, 2);
+  sct.AddHit(0, 5, 2);
+  sct.AddHit(0, 6, 2);
+  sct.AddHit(0, 7, 4);
+  sct.AddHit(0, 127, 3);
+  sct.AddHit(1, 0, 7);
+  sct.AddHit(8, 3, 2);
+  std::vector<SCTStripBitmap::Cluster> clusters;
+  SCTStripBitmap strips(sct);
+  strips.clusters(clusters);
+  SCTStripBitmap inTime(sct, SCTStripBitmap::pattern_filter("X1X"));
+  inTime.clusters(clusters);
+  if (strips.occupancy()!=6 || inTime.occupancy()!=5 || clusters.size()!=6 ||
+      clusters[0].first_strip!=5 || clusters[0].width!=3 || clusters[1].first_strip!=127 || clusters[1].width!=2 ||
+      clusters[2].side!=1 || clusters[2].first_strip!=3 || clusters[3].width!=2 || clusters[5].side!=1) {
+    ERROR("SCTStripBitmap clusters are wrong");
+    errors++;
+  }
+  return errors;
 }